@@ -0,0 +1,200 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/* Times the filter evaluation over generated rows: the compiled program, which searches
+ * all the text operands in one pass, against the operand tree walk, which searches them
+ * one by one, and against the regular expression mode given the same operands as 
+ * alternatives. Usage: filter-bench [rows [operands]], 100000 rows and 100 operands by 
+ * default. Exits with 1 if two evaluations disagree on a row. */
+
+#include "nactv-debug.h"
+#include "filter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#define DEFAULT_ROWS 100000
+#define DEFAULT_OPERANDS 100
+
+static const char *protocols[] = { "tcp", "tcp6", "udp", "udp6" };
+static const char *states[] = { "ESTABLISHED", "LISTEN", "TIME_WAIT", "CLOSE_WAIT" };
+static const char *programs[] = { "firefox", "sshd", "Xorg", "systemd-resolved", "curl" };
+
+/* A row text as the view makes it: the visible columns, each after the column separator */
+static char *make_row_text (GRand *rand)
+{
+	return g_strdup_printf("   %s   10.%d.%d.%d   %d   host%05d.example.net   192.168.%d.%d   %d   %s   %s",
+	                       protocols[g_rand_int_range(rand, 0, G_N_ELEMENTS(protocols))],
+	                       g_rand_int_range(rand, 0, 256), g_rand_int_range(rand, 0, 256),
+	                       g_rand_int_range(rand, 0, 256), g_rand_int_range(rand, 1024, 65536),
+	                       g_rand_int_range(rand, 0, 100000),
+	                       g_rand_int_range(rand, 0, 256), g_rand_int_range(rand, 0, 256),
+	                       g_rand_int_range(rand, 1, 65536),
+	                       states[g_rand_int_range(rand, 0, G_N_ELEMENTS(states))],
+	                       programs[g_rand_int_range(rand, 0, G_N_ELEMENTS(programs))]);
+}
+
+/* Host names ORed, as a pasted list of hosts; a few rows match each one. 
+ * regex gets the same names as alternatives. */
+static char *make_filter_text (GRand *rand, int operands, char **regex)
+{
+	GString *text = g_string_new(""), *pattern = g_string_new("");
+	int i;
+	for (i=0; i<operands; i++)
+	{
+		int host = g_rand_int_range(rand, 0, 100000);
+		if (i > 0)
+		{
+			g_string_append(text, " OR ");
+			g_string_append_c(pattern, '|');
+		}
+		g_string_append_printf(text, "host%05d.example", host);
+		g_string_append_printf(pattern, "host%05d\\.example", host);
+	}
+	*regex = g_string_free(pattern, FALSE);
+	return g_string_free(text, FALSE);
+}
+
+static int run_bench (char **texts, NetConnection *conns, int rows, Filter *filter,
+                      int caseSensitivity, const char *name)
+{
+	FilterProgram *program = CompileFilter(filter, caseSensitivity);
+	GTimer *timer = g_timer_new();
+	guint8 *tree_result = (guint8*)g_malloc(rows);
+	double tree_time, program_time;
+	int i, passed = 0, mismatches = 0;
+
+	g_timer_reset(timer);
+	for (i=0; i<rows; i++)
+		tree_result[i] = (IsConnectionFiltered(texts[i], &conns[i], filter, caseSensitivity) != 0);
+	tree_time = g_timer_elapsed(timer, NULL);
+
+	g_timer_reset(timer);
+	for (i=0; i<rows; i++)
+	{
+		int filtered = (RunFilterProgram(program, texts[i], &conns[i]) != 0);
+		if (filtered != tree_result[i])
+			mismatches++;
+		passed += filtered;
+	}
+	program_time = g_timer_elapsed(timer, NULL);
+
+	printf("%-16s tree %8.1f ms   program %8.1f ms   %5.1fx   %d rows passed\n", name,
+	       tree_time * 1000, program_time * 1000,
+	       (program_time > 0) ? tree_time / program_time : 0., passed);
+	if (mismatches > 0)
+		printf("%s: %d rows differ\n", name, mismatches);
+
+	g_free(tree_result);
+	g_timer_destroy(timer);
+	FreeFilterProgram(program);
+	return mismatches;
+}
+
+/* As the view matches a regex: from the first column, after the column separator */
+static int run_regex_bench (char **texts, NetConnection *conns, int rows, Filter *filter,
+                            int caseSensitivity, const char *pattern, GRegexCompileFlags flags, 
+                            const char *name)
+{
+	GRegex *regex = g_regex_new(pattern, flags | G_REGEX_OPTIMIZE, 0, NULL);
+	FilterProgram *program;
+	GTimer *timer;
+	guint8 *program_result;
+	double regex_time, program_time;
+	int i, passed = 0, mismatches = 0;
+
+	if (regex == NULL)
+	{
+		printf("%s: the regex does not compile\n", name);
+		return 1;
+	}
+	program = CompileFilter(filter, caseSensitivity);
+	timer = g_timer_new();
+	program_result = (guint8*)g_malloc(rows);
+	g_timer_reset(timer);
+	for (i=0; i<rows; i++)
+		program_result[i] = (RunFilterProgram(program, texts[i], &conns[i]) != 0);
+	program_time = g_timer_elapsed(timer, NULL);
+
+	g_timer_reset(timer);
+	for (i=0; i<rows; i++)
+	{
+		int filtered = (g_regex_match(regex, texts[i] + strlen("   "), 0, NULL) != 0);
+		if (filtered != program_result[i])
+			mismatches++;
+		passed += filtered;
+	}
+	regex_time = g_timer_elapsed(timer, NULL);
+
+	printf("%-16s regex %7.1f ms   program %8.1f ms   %5.1fx   %d rows passed\n", name,
+	       regex_time * 1000, program_time * 1000,
+	       (program_time > 0) ? regex_time / program_time : 0., passed);
+	if (mismatches > 0)
+		printf("%s: %d rows differ\n", name, mismatches);
+
+	g_free(program_result);
+	g_timer_destroy(timer);
+	g_regex_unref(regex);
+	FreeFilterProgram(program);
+	return mismatches;
+}
+
+int main (int argc, char **argv)
+{
+	int rows = (argc > 1) ? atoi(argv[1]) : DEFAULT_ROWS;
+	int operands = (argc > 2) ? atoi(argv[2]) : DEFAULT_OPERANDS;
+	GRand *rand = g_rand_new_with_seed(1);
+	NetConnection *conns;
+	char **texts, *filter_text, *regex_text;
+	Filter *filter, *filter_no_case;
+	int i, mismatches = 0;
+
+	if (rows <= 0 || operands <= 0)
+	{
+		fprintf(stderr, "usage: %s [rows [operands]]\n", argv[0]);
+		return 2;
+	}
+
+	texts = (char**)g_malloc(sizeof(char*) * rows);
+	conns = (NetConnection*)g_malloc0(sizeof(NetConnection) * rows);
+	for (i=0; i<rows; i++)
+		texts[i] = make_row_text(rand);
+	filter_text = make_filter_text(rand, operands, &regex_text);
+	filter = ParseFilter(filter_text, NULL);
+	filter_no_case = CaseFoldFilterUTF8(filter);
+
+	printf("%d rows, %d operands\n", rows, operands);
+	mismatches += run_bench(texts, conns, rows, filter, casSensitive, "case sensitive");
+	mismatches += run_bench(texts, conns, rows, filter_no_case, casInsensitiveLibc, "case insensitive");
+	mismatches += run_regex_bench(texts, conns, rows, filter, casSensitive, regex_text, 0, 
+	                              "case sensitive");
+	mismatches += run_regex_bench(texts, conns, rows, filter_no_case, casInsensitiveLibc, regex_text, 
+	                              G_REGEX_CASELESS, "case insensitive");
+
+	FreeFilter(filter_no_case);
+	FreeFilter(filter);
+	g_free(filter_text);
+	g_free(regex_text);
+	for (i=0; i<rows; i++)
+		g_free(texts[i]);
+	g_free(texts);
+	g_free(conns);
+	g_rand_free(rand);
+	return (mismatches > 0) ? 1 : 0;
+}
@@ -22,10 +22,15 @@
 #include "nactv-debug.h"
 #include "filter.h"
 #include "utils.h"
+#include "prefixtrie.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <glib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #define MAX_FILTER_LEN 100100100
 
@@ -43,10 +48,15 @@ static int FindStr(const char** pCh, const char *str);
 static int FindStrNoCase(const char** pCh, const char *str);
 
 static FilterOperand* GetFilterExpression(const char** pCh, char** pMask);
+static FilterTerm* ParseFilterTerm(const char* text);
+static void RefTermData(FilterTerm* term);
+static void UnrefTermData(FilterTerm* term);
+static int TermIsFiltered(const FilterTerm* term, NetConnection* conn);
 
 static FilterOperand* CaseFoldOperandUTF8(FilterOperand* oper);
-static int NodeIsFiltered (const char* entryText, FilterOperand* op, int caseSensitivity);
+static int NodeIsFiltered (const char* entryText, NetConnection* conn, FilterOperand* op, int caseSensitivity);
 static void PrintNode(char** result, int* resultMaxLen, FilterOperand* op);
+static int PrintedTermsKept(Filter* filter, const char* filterText);
 static void FreeOperand(FilterOperand* oper);
 
 
@@ -107,7 +117,13 @@ Filter* ParseFilterNoOperators (const char* filterText)
 int IsFiltered (const char* entryText, Filter* filter, int caseSensitivity)
 {
 	g_assert(entryText != NULL);
-	return NodeIsFiltered(entryText, filter, caseSensitivity);	
+	return NodeIsFiltered(entryText, NULL, filter, caseSensitivity);	
+}
+
+int IsConnectionFiltered (const char* entryText, NetConnection* conn, Filter* filter, int caseSensitivity)
+{
+	g_assert(entryText != NULL && conn != NULL);
+	return NodeIsFiltered(entryText, conn, filter, caseSensitivity);	
 }
 
 char* PrintFilter (Filter* filter)
@@ -121,6 +137,7 @@ char* PrintFilter (Filter* filter)
 	result = (char*)g_malloc0(resultMaxLen);
 
 	PrintNode(&result, &resultMaxLen, filter);	
+	g_assert(PrintedTermsKept(filter, result));
 	
 	return result;
 }
@@ -248,6 +265,7 @@ static FilterOperand* GetFilterExpression (const char** pCh, char** pMask)
 			case ocQuote:
 			{
 				int stringMaxLen = 64, actualLen = 0;
+				int quoted = FALSE;
 				char *string = (char*)g_malloc0(stringMaxLen);
 
 				while(*pLocalMask == ocQuote || *pLocalMask == ocFreeString)
@@ -257,6 +275,7 @@ static FilterOperand* GetFilterExpression (const char** pCh, char** pMask)
 						const char *pLocalStr = NULL;
 						int localStrLen = 0;
 						
+						quoted = TRUE;
 						pLocalMask++; pLocalCh++;
 						pLocalStr = pLocalCh;
 						while(*pLocalMask == ocQuoteString) { pLocalMask++; pLocalCh++; }
@@ -285,6 +304,8 @@ static FilterOperand* GetFilterExpression (const char** pCh, char** pMask)
 				
 				pNode = (FilterOperand*)g_malloc0(sizeof(FilterOperand));
 				pNode->value = string_replace(string, "\"\"", "\"");	
+				if (!quoted)
+					pNode->term = ParseFilterTerm(pNode->value);
 				pNode->operator = (notState) ? ovNOT : ovNone;
 				notState = FALSE;
 				g_free(string);
@@ -395,7 +416,7 @@ static int FindStrNoCase (const char** pCh, const char *str)
 }	
 
 
-static int NodeIsFiltered (const char* entryText, FilterOperand* op, int caseSensitivity)
+static int NodeIsFiltered (const char* entryText, NetConnection* conn, FilterOperand* op, int caseSensitivity)
 {
 	int filtered = TRUE;	
 	int curentOp = ovNone;
@@ -410,7 +431,9 @@ static int NodeIsFiltered (const char* entryText, FilterOperand* op, int caseSen
 				if (op->value != NULL)
 				{
 					int contains = FALSE;
-					switch(caseSensitivity)
+					if (op->term != NULL && conn != NULL)
+						contains = TermIsFiltered(op->term, conn);
+					else switch(caseSensitivity)
 					{
 						case casSensitive:
 							contains = (strstr(entryText, op->value) != 0);
@@ -424,7 +447,7 @@ static int NodeIsFiltered (const char* entryText, FilterOperand* op, int caseSen
 					elementFiltered = (op->operator != ovNOT) ? contains : !contains;
 				}else if (op->operator == ovGroup || op->operator == ovNOTGroup)
 				{
-					int groupFiltered = NodeIsFiltered(entryText, op->child, caseSensitivity);
+					int groupFiltered = NodeIsFiltered(entryText, conn, op->child, caseSensitivity);
 					elementFiltered = (op->operator == ovGroup) ? groupFiltered : !groupFiltered;
 				}
 
@@ -453,6 +476,22 @@ static int NodeIsFiltered (const char* entryText, FilterOperand* op, int caseSen
 }
 
 
+/* A field term is printed unquoted, otherwise it is parsed back as text */
+static int PrintsAsTerm (FilterOperand* op)
+{
+	char *mask;
+	int i, plain;
+	
+	if (op->term == NULL || op->value[0] == '\0')
+		return FALSE;
+	mask = PreParseFilter(op->value);
+	plain = TRUE;
+	for (i=0; mask[i] != '\0' && plain; i++)
+		plain = (mask[i] == ocFreeString);
+	g_free(mask);
+	return plain;
+}
+
 static void PrintNode (char** result, int* resultMaxLen, FilterOperand* op)
 {
 	int resultLen = strlen(*result); /*estimated result len >= real len*/
@@ -460,7 +499,15 @@ static void PrintNode (char** result, int* resultMaxLen, FilterOperand* op)
 	{
 		ERROR_IF(resultLen > MAX_FILTER_LEN);
 		
-		if (op->value != NULL)
+		if (op->value != NULL && PrintsAsTerm(op))
+		{
+			resultLen += strlen("!") + strlen(op->value);
+			EnsureStringLen(result, resultMaxLen, resultLen);
+			if (op->operator == ovNOT)
+				strcat(*result, "!");
+			strcat(*result, op->value);
+			
+		}else if (op->value != NULL)
 		{
 			char *outvalue = string_replace(op->value, "\"", "\"\"");
 			resultLen += strlen("!") + strlen("\"\"") + strlen(outvalue);
@@ -501,6 +548,36 @@ static void PrintNode (char** result, int* resultMaxLen, FilterOperand* op)
 	ERROR_IF(resultLen > MAX_FILTER_LEN);
 }		
 
+static void AppendTermValues (FilterOperand* op, GString* values)
+{
+	for (; op != NULL; op = op->sibling)
+	{
+		if (op->term != NULL)
+		{
+			g_string_append(values, op->value);
+			g_string_append_c(values, '\n');
+		}
+		AppendTermValues(op->child, values);
+	}
+}
+
+/* The printed text is parsed back to the same field terms */
+static int PrintedTermsKept (Filter* filter, const char* filterText)
+{
+	Filter *parsed = ParseFilter(filterText, NULL);
+	GString *values = g_string_new(""), *parsedValues = g_string_new("");
+	int kept;
+	
+	AppendTermValues(filter, values);
+	AppendTermValues(parsed, parsedValues);
+	kept = (strcmp(values->str, parsedValues->str) == 0);
+	
+	g_string_free(values, TRUE);
+	g_string_free(parsedValues, TRUE);
+	FreeFilter(parsed);
+	return kept;
+}
+
 
 static FilterOperand* CaseFoldOperandUTF8 (FilterOperand* oper)
 {
@@ -513,6 +590,11 @@ static FilterOperand* CaseFoldOperandUTF8 (FilterOperand* oper)
 			res->value = g_utf8_casefold(oper->value, -1);
 			ERROR_IF(strlen(res->value) > MAX_FILTER_LEN);
 		}
+		if (oper->term != NULL)
+		{
+			res->term = (FilterTerm*)g_memdup(oper->term, sizeof(FilterTerm));
+			RefTermData(res->term);
+		}
 		if (oper->sibling != NULL)
 			res->sibling = CaseFoldOperandUTF8(oper->sibling);
 		if (oper->child != NULL)
@@ -531,12 +613,1063 @@ static void FreeOperand (FilterOperand* oper)
 		FreeOperand(oper->sibling);
 		if (oper->value != NULL)
 			g_free(oper->value);
+		if (oper->term != NULL)
+		{
+			UnrefTermData(oper->term);
+			g_free(oper->term);
+		}
 		g_free(oper);
 	}
 }
 
 
 
+
+/* The data shared by the copies of a term */
+static void RefTermData (FilterTerm* term)
+{
+	if (term->prefixes != NULL)
+		prefix_trie_ref(term->prefixes);
+	if (term->portSet != NULL)
+		g_atomic_int_inc(&term->portSet->refCount);
+}
+
+static void UnrefTermData (FilterTerm* term)
+{
+	prefix_trie_unref(term->prefixes);
+	if (term->portSet != NULL && g_atomic_int_dec_and_test(&term->portSet->refCount))
+		g_free(term->portSet);
+}
+
+
+static int ParsePortRange (const char* text, int* portLow, int* portHigh)
+{
+	char *end = NULL;
+	long low, high;
+	
+	if (*text < '0' || *text > '9')
+		return FALSE;
+	low = high = strtol(text, &end, 10);
+	if (*end == '-' && end[1] >= '0' && end[1] <= '9')
+		high = strtol(end + 1, &end, 10);
+	if (*end != '\0' || low > high || high > 65535)
+		return FALSE;
+	*portLow = (int)low;
+	*portHigh = (int)high;
+	return TRUE;
+}
+
+#define PortSetBit(bits, port) (((bits)[(port) >> 5] >> ((port) & 31)) & 1)
+
+static void PortSetAddRange (guint32* bits, int low, int high)
+{
+	int port;
+	for (port=low; port<=high; port++)
+		bits[port >> 5] |= 1u << (port & 31);
+}
+
+/* One range is compared directly; a list of ports and ranges, 80,443,8000-8100, and the 
+ * ranges of a protocol, udp/53,tcp/8080, are in a port set */
+static int ParsePortTerm (const char* text, FilterTerm* term)
+{
+	char **items;
+	int i, parsed = TRUE;
+	
+	if (strchr(text, ',') == NULL && strchr(text, '/') == NULL)
+		return ParsePortRange(text, &term->portLow, &term->portHigh);
+	
+	term->portSet = (FilterPortSet*)g_malloc0(sizeof(FilterPortSet));
+	term->portSet->refCount = 1;
+	items = g_strsplit(text, ",", -1);
+	for (i=0; items[i] != NULL && parsed; i++)
+	{
+		const char *ports = items[i], *slash = strchr(items[i], '/');
+		int low, high, tcp = TRUE, udp = TRUE;
+		
+		if (slash != NULL)
+		{
+			tcp = (slash - items[i] == 3 && g_ascii_strncasecmp(items[i], "tcp", 3) == 0);
+			udp = (slash - items[i] == 3 && g_ascii_strncasecmp(items[i], "udp", 3) == 0);
+			ports = slash + 1;
+		}
+		parsed = ((tcp || udp) && ParsePortRange(ports, &low, &high));
+		if (parsed && tcp)
+			PortSetAddRange(term->portSet->bits[FILTER_PORT_SET_TCP], low, high);
+		if (parsed && udp)
+			PortSetAddRange(term->portSet->bits[FILTER_PORT_SET_UDP], low, high);
+	}
+	g_strfreev(items);
+	
+	if (!parsed)
+	{
+		g_free(term->portSet);
+		term->portSet = NULL;
+	}
+	return parsed;
+}
+
+/* One prefix is compared directly; a list of prefixes, 10.0.0.0/8,fc00::/7, or a prefix list 
+ * file, @/path/file, is looked up in a prefix trie */
+static int ParseAddressTerm (const char* text, FilterTerm* term)
+{
+	int parsed = TRUE;
+	
+	if (*text == '@')
+	{
+		term->prefixes = prefix_trie_new();
+		parsed = (text[1] != '\0' && prefix_trie_add_file(term->prefixes, text + 1, ""));
+	}else if (strchr(text, ',') != NULL)
+	{
+		char **prefixes = g_strsplit(text, ",", -1);
+		int i;
+		term->prefixes = prefix_trie_new();
+		for (i=0; prefixes[i] != NULL && parsed; i++)
+		{
+			NetAddress address;
+			int prefixLen;
+			parsed = net_address_parse_prefix(prefixes[i], &address, &prefixLen);
+			if (parsed)
+				prefix_trie_add(term->prefixes, &address, prefixLen, GINT_TO_POINTER(TRUE));
+		}
+		g_strfreev(prefixes);
+	}else
+		return net_address_parse_prefix(text, &term->address, &term->prefixLen);
+	
+	if (!parsed)
+	{
+		prefix_trie_unref(term->prefixes);
+		term->prefixes = NULL;
+	}
+	return parsed;
+}
+
+static guint ParseProtocols (const char* text)
+{
+	if (g_ascii_strcasecmp(text, "tcp") == 0)
+		return (1 << NC_PROTOCOL_TCP) | (1 << NC_PROTOCOL_TCP6);
+	if (g_ascii_strcasecmp(text, "udp") == 0)
+		return (1 << NC_PROTOCOL_UDP) | (1 << NC_PROTOCOL_UDP6);
+	if (g_ascii_strcasecmp(text, "tcp6") == 0)
+		return (1 << NC_PROTOCOL_TCP6);
+	if (g_ascii_strcasecmp(text, "udp6") == 0)
+		return (1 << NC_PROTOCOL_UDP6);
+	return 0;
+}
+
+/* Returns NULL if text is not a field operand */
+static FilterTerm* ParseFilterTerm (const char* text)
+{
+	static const struct { const char *name; int field; } fieldNames[] = {
+		{"port", ftfPort}, {"lport", ftfLocalPort}, {"rport", ftfRemotePort},
+		{"addr", ftfAddress}, {"laddr", ftfLocalAddress}, {"raddr", ftfRemoteAddress},
+		{"state", ftfState}, {"proto", ftfProtocol}, {"pid", ftfPid}, {"prog", ftfProgram}
+	};
+	FilterTerm term;
+	const char *argument = strchr(text, ':');
+	int i, parsed = FALSE;
+	
+	if (argument == NULL)
+		return NULL;
+	memset(&term, 0, sizeof(term));
+	term.field = -1;
+	for (i=0; i<G_N_ELEMENTS(fieldNames); i++)
+		if (strlen(fieldNames[i].name) == (size_t)(argument - text) && 
+		    g_ascii_strncasecmp(text, fieldNames[i].name, argument - text) == 0)
+			term.field = fieldNames[i].field;
+	argument++;
+	
+	switch(term.field)
+	{
+		case ftfPort:
+		case ftfLocalPort:
+		case ftfRemotePort:
+			parsed = ParsePortTerm(argument, &term);
+			break;
+		case ftfAddress:
+		case ftfLocalAddress:
+		case ftfRemoteAddress:
+			parsed = ParseAddressTerm(argument, &term);
+			break;
+		case ftfState:
+			term.state = net_get_state_by_name(argument);
+			parsed = (term.state >= 0);
+			break;
+		case ftfProtocol:
+			term.protocols = ParseProtocols(argument);
+			parsed = (term.protocols != 0);
+			break;
+		case ftfPid:
+		{
+			char *end = NULL;
+			term.pid = strtol(argument, &end, 10);
+			parsed = (*argument >= '0' && *argument <= '9' && *end == '\0' && term.pid > 0);
+			break;
+		}
+		case ftfProgram:
+			parsed = (*argument != '\0' && strlen(argument) < sizeof(term.program));
+			if (parsed)
+				n_strlcpy(term.program, argument, sizeof(term.program));
+			break;
+	}
+	return (parsed) ? (FilterTerm*)g_memdup(&term, sizeof(term)) : NULL;
+}
+
+static int AddressBitsEqual (const guint32* addr1, const guint32* addr2, int prefixLen)
+{
+	const guint8 *bytes1 = (const guint8*)addr1, *bytes2 = (const guint8*)addr2;
+	int fullBytes = prefixLen / 8, restBits = prefixLen % 8;
+	
+	if (memcmp(bytes1, bytes2, fullBytes) != 0)
+		return FALSE;
+	if (restBits > 0)
+	{
+		guint8 mask = (guint8)(0xFF << (8 - restBits));
+		return ((bytes1[fullBytes] & mask) == (bytes2[fullBytes] & mask));
+	}
+	return TRUE;
+}
+
+/* An IPv4 term also matches the IPv4 mapped IPv6 addresses, like the kernel filter */
+static int AddressIsFiltered (const FilterTerm* term, const NetAddress* address)
+{
+	if (term->prefixes != NULL)
+		return (prefix_trie_lookup(term->prefixes, address) != NULL);
+	if (address->family == term->address.family)
+		return AddressBitsEqual(address->addr, term->address.addr, term->prefixLen);
+	if (address->family == AF_INET6 && term->address.family == AF_INET &&
+	    address->addr[0] == 0 && address->addr[1] == 0 && address->addr[2] == htonl(0xFFFF))
+		return AddressBitsEqual(address->addr + 3, term->address.addr, term->prefixLen);
+	return FALSE;
+}
+
+static int PortIsFiltered (const FilterTerm* term, int protocol, int port)
+{
+	if (term->portSet != NULL)
+	{
+		int set = (protocol == NC_PROTOCOL_UDP || protocol == NC_PROTOCOL_UDP6) ? 
+			FILTER_PORT_SET_UDP : FILTER_PORT_SET_TCP;
+		return (port >= 0 && port <= 65535 && PortSetBit(term->portSet->bits[set], port));
+	}
+	return (port >= term->portLow && port <= term->portHigh);
+}
+
+static int TermIsFiltered (const FilterTerm* term, NetConnection* conn)
+{
+	switch(term->field)
+	{
+		case ftfPort:
+			return PortIsFiltered(term, conn->protocol, conn->localport) || 
+			       PortIsFiltered(term, conn->protocol, conn->remoteport);
+		case ftfLocalPort:
+			return PortIsFiltered(term, conn->protocol, conn->localport);
+		case ftfRemotePort:
+			return PortIsFiltered(term, conn->protocol, conn->remoteport);
+		case ftfAddress:
+			return AddressIsFiltered(term, &conn->localaddr) || AddressIsFiltered(term, &conn->remoteaddr);
+		case ftfLocalAddress:
+			return AddressIsFiltered(term, &conn->localaddr);
+		case ftfRemoteAddress:
+			return AddressIsFiltered(term, &conn->remoteaddr);
+		case ftfState:
+			/* the state must be displayed; udp has only some */
+			return (conn->state == term->state && *net_connection_get_state_name(conn) != '\0');
+		case ftfProtocol:
+			return ((term->protocols & (1 << conn->protocol)) != 0);
+		case ftfPid:
+			return (conn->pid == term->pid);
+		case ftfProgram:
+			return (conn->programname != NULL && g_ascii_strcasecmp(conn->programname, term->program) == 0);
+		default:
+			g_assert(0);
+			return FALSE;
+	}
+}
+
+
+/* The sockets that can pass a part of the filter: the ones of protocols, in states, that 
+ * match condition. exact is FALSE when more sockets than the ones passing the filter part 
+ * are included. */
+typedef struct
+{
+	NetSocketCondition *condition;
+	guint32 states;
+	guint protocols;
+	int exact;
+} SocketFilterPart;
+
+static SocketFilterPart SocketFilterPartAll (int exact)
+{
+	SocketFilterPart part = { NULL, NSF_ALL_STATES, NSF_ALL_PROTOCOLS, exact };
+	return part;
+}
+
+static NetSocketCondition* NewPortsCondition (int type, const FilterTerm* term)
+{
+	NetSocketCondition *condition = net_socket_condition_new(type, NULL, NULL);
+	condition->port_low = term->portLow;
+	condition->port_high = term->portHigh;
+	return condition;
+}
+
+static NetSocketCondition* NewAddressCondition (int type, const FilterTerm* term)
+{
+	NetSocketCondition *condition = net_socket_condition_new(type, NULL, NULL);
+	condition->address = term->address;
+	condition->prefix_len = term->prefixLen;
+	return condition;
+}
+
+#define MAX_PORT_SET_CONDITION_RANGES 16
+
+/* Returns NULL if the ports have too many ranges for the kernel filter */
+static NetSocketCondition* NewPortSetCondition (int type, const guint32* bits)
+{
+	NetSocketCondition *condition = NULL;
+	int port = 0, nranges = 0;
+	
+	while (TRUE)
+	{
+		NetSocketCondition *range;
+		while (port <= 65535 && !PortSetBit(bits, port))
+			port++;
+		if (port > 65535)
+			break;
+		if (++nranges > MAX_PORT_SET_CONDITION_RANGES)
+		{
+			net_socket_condition_free(condition);
+			return NULL;
+		}
+		range = net_socket_condition_new(type, NULL, NULL);
+		range->port_low = port;
+		while (port <= 65535 && PortSetBit(bits, port))
+			port++;
+		range->port_high = port - 1;
+		condition = (condition == NULL) ? range : net_socket_condition_new(NSC_OR, condition, range);
+	}
+	return condition;
+}
+
+static int PortSetBitsEmpty (const guint32* bits)
+{
+	int i;
+	for (i=0; i<65536 / 32; i++)
+		if (bits[i] != 0)
+			return FALSE;
+	return TRUE;
+}
+
+/* Passed to the kernel if the ports are the same for tcp and udp or are of one protocol */
+static SocketFilterPart GetPortSetSocketFilter (const FilterTerm* term)
+{
+	SocketFilterPart part = SocketFilterPartAll(TRUE);
+	const guint32 *bits = term->portSet->bits[FILTER_PORT_SET_TCP];
+	NetSocketCondition *local = NULL, *remote = NULL;
+	
+	if (PortSetBitsEmpty(term->portSet->bits[FILTER_PORT_SET_UDP]))
+		part.protocols = (1 << NC_PROTOCOL_TCP) | (1 << NC_PROTOCOL_TCP6);
+	else if (PortSetBitsEmpty(bits))
+	{
+		part.protocols = (1 << NC_PROTOCOL_UDP) | (1 << NC_PROTOCOL_UDP6);
+		bits = term->portSet->bits[FILTER_PORT_SET_UDP];
+	}else if (memcmp(bits, term->portSet->bits[FILTER_PORT_SET_UDP], sizeof(term->portSet->bits[0])) != 0)
+		return SocketFilterPartAll(FALSE);
+	
+	if (term->field != ftfRemotePort)
+		local = NewPortSetCondition(NSC_LOCAL_PORTS, bits);
+	if (term->field != ftfLocalPort)
+		remote = NewPortSetCondition(NSC_REMOTE_PORTS, bits);
+	if ((term->field != ftfRemotePort && local == NULL) || (term->field != ftfLocalPort && remote == NULL))
+	{
+		net_socket_condition_free(local);
+		net_socket_condition_free(remote);
+		part.exact = FALSE; /*the protocols are still exact*/
+	}else if (local != NULL && remote != NULL)
+		part.condition = net_socket_condition_new(NSC_OR, local, remote);
+	else
+		part.condition = (local != NULL) ? local : remote;
+	return part;
+}
+
+static SocketFilterPart GetTermSocketFilter (const FilterTerm* term)
+{
+	SocketFilterPart part = SocketFilterPartAll(TRUE);
+	if (term->prefixes != NULL)
+	{
+		/* the prefix lists are not passed to the kernel */
+		part.exact = FALSE;
+		return part;
+	}
+	if (term->portSet != NULL)
+		return GetPortSetSocketFilter(term);
+	switch(term->field)
+	{
+		case ftfPort:
+			part.condition = net_socket_condition_new(NSC_OR, NewPortsCondition(NSC_LOCAL_PORTS, term), 
+			                                          NewPortsCondition(NSC_REMOTE_PORTS, term));
+			break;
+		case ftfLocalPort:
+			part.condition = NewPortsCondition(NSC_LOCAL_PORTS, term);
+			break;
+		case ftfRemotePort:
+			part.condition = NewPortsCondition(NSC_REMOTE_PORTS, term);
+			break;
+		case ftfAddress:
+			part.condition = net_socket_condition_new(NSC_OR, NewAddressCondition(NSC_LOCAL_ADDRESS, term), 
+			                                          NewAddressCondition(NSC_REMOTE_ADDRESS, term));
+			break;
+		case ftfLocalAddress:
+			part.condition = NewAddressCondition(NSC_LOCAL_ADDRESS, term);
+			break;
+		case ftfRemoteAddress:
+			part.condition = NewAddressCondition(NSC_REMOTE_ADDRESS, term);
+			break;
+		case ftfState:
+			/* CLOSE is not displayed for udp; CLOSED rows are kept by the view after the 
+			 * kernel dropped the socket */
+			if (term->state == NC_TCP_CLOSE || term->state == NC_TCP_CLOSED)
+				part.exact = FALSE;
+			else
+				part.states = 1 << term->state;
+			break;
+		case ftfProtocol:
+			part.protocols = term->protocols;
+			break;
+		case ftfPid:
+		case ftfProgram:
+			/* the kernel does not know the socket owners */
+			part.exact = FALSE;
+			break;
+		default:
+			g_assert(0);
+	}
+	return part;
+}
+
+static SocketFilterPart NotSocketFilter (SocketFilterPart part)
+{
+	if (part.exact && part.condition == NULL && part.protocols == NSF_ALL_PROTOCOLS)
+	{
+		part.states = ~part.states;
+		return part;
+	}
+	if (part.exact && part.condition == NULL && part.states == NSF_ALL_STATES)
+	{
+		part.protocols = ~part.protocols & NSF_ALL_PROTOCOLS;
+		return part;
+	}
+	if (part.exact && part.states == NSF_ALL_STATES && part.protocols == NSF_ALL_PROTOCOLS)
+	{
+		part.condition = net_socket_condition_new(NSC_NOT, part.condition, NULL);
+		return part;
+	}
+	net_socket_condition_free(part.condition);
+	return SocketFilterPartAll(FALSE);
+}
+
+static SocketFilterPart AndSocketFilter (SocketFilterPart part1, SocketFilterPart part2)
+{
+	SocketFilterPart part;
+	if (part1.condition != NULL && part2.condition != NULL)
+		part.condition = net_socket_condition_new(NSC_AND, part1.condition, part2.condition);
+	else
+		part.condition = (part1.condition != NULL) ? part1.condition : part2.condition;
+	part.states = part1.states & part2.states;
+	part.protocols = part1.protocols & part2.protocols;
+	part.exact = part1.exact && part2.exact;
+	return part;
+}
+
+static SocketFilterPart OrSocketFilter (SocketFilterPart part1, SocketFilterPart part2)
+{
+	SocketFilterPart part;
+	int statesOnly = (part1.protocols == NSF_ALL_PROTOCOLS && part2.protocols == NSF_ALL_PROTOCOLS);
+	int protocolsOnly = (part1.states == NSF_ALL_STATES && part2.states == NSF_ALL_STATES);
+	part.states = part1.states | part2.states;
+	part.protocols = part1.protocols | part2.protocols;
+	if (part1.condition != NULL && part2.condition != NULL)
+	{
+		part.condition = net_socket_condition_new(NSC_OR, part1.condition, part2.condition);
+		part.exact = part1.exact && part2.exact && statesOnly && protocolsOnly;
+	}else
+	{
+		/* one of the parts accepts any address and port */
+		part.exact = part1.exact && part2.exact && part1.condition == part2.condition && 
+		             (statesOnly || protocolsOnly);
+		net_socket_condition_free(part1.condition);
+		net_socket_condition_free(part2.condition);
+		part.condition = NULL;
+	}
+	return part;
+}
+
+/* Follows the evaluation order of NodeIsFiltered */
+static SocketFilterPart GetNodeSocketFilter (FilterOperand* op)
+{
+	SocketFilterPart filter = SocketFilterPartAll(TRUE);
+	int curentOp = ovNone;
+	while(op != NULL)
+	{
+		if (op->value != NULL || op->operator == ovGroup || op->operator == ovNOTGroup)
+		{
+			SocketFilterPart element;
+			if (op->value != NULL)
+			{
+				element = (op->term != NULL) ? GetTermSocketFilter(op->term) : SocketFilterPartAll(FALSE);
+				if (op->operator == ovNOT)
+					element = NotSocketFilter(element);
+			}else
+			{
+				element = GetNodeSocketFilter(op->child);
+				if (op->operator == ovNOTGroup)
+					element = NotSocketFilter(element);
+			}
+			
+			switch(curentOp)
+			{
+				case ovNone:
+					net_socket_condition_free(filter.condition);
+					filter = element;
+					break;
+				case ovAND:
+					filter = AndSocketFilter(filter, element);
+					break;
+				case ovOR:
+					filter = OrSocketFilter(filter, element);
+					break;
+			}
+		}else if (op->operator == ovAND || op->operator == ovOR)
+		{
+			curentOp = op->operator;
+		}
+		op = op->sibling;
+	}
+	return filter;
+}
+
+int FilterUsesProcesses (Filter* filter)
+{
+	FilterOperand *op;
+	for (op = filter; op != NULL; op = op->sibling)
+	{
+		if (op->term != NULL && (op->term->field == ftfPid || op->term->field == ftfProgram))
+			return TRUE;
+		if (op->child != NULL && FilterUsesProcesses(op->child))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+NetSocketFilter* GetFilterSocketFilter (Filter* filter)
+{
+	SocketFilterPart part = GetNodeSocketFilter(filter);
+	NetSocketFilter *socketFilter;
+	
+	if (part.condition == NULL && part.states == NSF_ALL_STATES && part.protocols == NSF_ALL_PROTOCOLS)
+		return NULL;
+	socketFilter = (NetSocketFilter*)g_malloc0(sizeof(NetSocketFilter));
+	socketFilter->condition = part.condition;
+	socketFilter->states = part.states;
+	socketFilter->protocols = part.protocols;
+	return socketFilter;
+}
+
+
+
+/* The text operands of a program are searched with an Aho-Corasick automaton: a DFA over the 
+ * classes of the bytes used by the literals, whose states list the literals ending there. */
+typedef struct
+{
+	guint8 byteClass[256]; /*0 for the bytes not used by any literal*/
+	int classesNumber;
+	int statesNumber;
+	/* [state * classesNumber + class]: the row of the next state, state * classesNumber, 
+	 * negated when literals end in that state */
+	int *transitions;
+	int *outputStart, *outputCount; /*the literals ending in a state, in outputs*/
+	int *outputs;
+} TextMatcher;
+
+enum FilterInstructionCode { fiTrue, fiText, fiAnyText, fiAllText, fiTerm, fiNot, fiDrop, fiAnd, fiOr, 
+                             fiSkipIfFalse, fiSkipIfTrue };
+
+typedef struct
+{
+	int code;
+	/* fiText: literal index; fiAnyText, fiAllText: literal set index; fiTerm: term index; 
+	 * fiSkip...: instructions skipped */
+	int arg;
+} FilterInstruction;
+
+struct _FilterProgram
+{
+	GArray *code; /*FilterInstruction; postfix, evaluated on a stack*/
+	GArray *terms; /*FilterTerm*/
+	GPtrArray *literals; /*the distinct text operands*/
+	GHashTable *literalIndexes; /*used only while compiling*/
+	GArray *literalSets; /*IntArray of literal indexes; used only while compiling*/
+	guint32 *literalSetMasks; /*matchWords for each literal set*/
+	int matchWords;
+	int caseSensitivity;
+	int maxStack;
+	TextMatcher matcher;
+};
+
+#define PROGRAM_LOCAL_MATCH_WORDS 8
+#define PROGRAM_LOCAL_STACK 64
+
+
+static void EmitInstruction (FilterProgram* program, int code, int arg, int* depth)
+{
+	FilterInstruction instruction;
+	instruction.code = code;
+	instruction.arg = arg;
+	g_array_append_val(program->code, instruction);
+	
+	switch(code)
+	{
+		case fiTrue:
+		case fiText:
+		case fiAnyText:
+		case fiAllText:
+		case fiTerm:
+			(*depth)++;
+			break;
+		case fiDrop:
+		case fiAnd:
+		case fiOr:
+			(*depth)--;
+			break;
+	}
+	if (*depth > program->maxStack)
+		program->maxStack = *depth;
+}
+
+static int AddProgramLiteral (FilterProgram* program, const char* value)
+{
+	gpointer index = NULL;
+	char *literal = (program->caseSensitivity == casSensitive) ? g_strdup(value) : g_ascii_strdown(value, -1);
+	
+	if (g_hash_table_lookup_extended(program->literalIndexes, literal, NULL, &index))
+	{
+		g_free(literal);
+		return GPOINTER_TO_INT(index);
+	}
+	g_ptr_array_add(program->literals, literal);
+	g_hash_table_insert(program->literalIndexes, literal, GINT_TO_POINTER(program->literals->len - 1));
+	return program->literals->len - 1;
+}
+
+static void CompileOperand (FilterProgram* program, FilterOperand* op, int* depth)
+{
+	if (op->term != NULL)
+	{
+		g_array_append_val(program->terms, *(op->term));
+		RefTermData(op->term);
+		EmitInstruction(program, fiTerm, program->terms->len - 1, depth);
+	}else if (op->value[0] == '\0')
+		EmitInstruction(program, fiTrue, 0, depth); /*found in any text*/
+	else
+		EmitInstruction(program, fiText, AddProgramLiteral(program, op->value), depth);
+}
+
+#define IsTextOperand(op) ((op) != NULL && (op)->value != NULL && (op)->term == NULL && \
+                           (op)->operator == ovNone && (op)->value[0] != '\0')
+
+/* Returns the last operand of the text operands joined by runOp starting with op; 
+ * a filter pasted as a list is a single run. */
+static FilterOperand* GetTextOperandsRun (FilterOperand* op, int runOp, int* runLength)
+{
+	*runLength = 1;
+	while(op->sibling != NULL && op->sibling->operator == runOp && IsTextOperand(op->sibling->sibling))
+	{
+		op = op->sibling->sibling;
+		(*runLength)++;
+	}
+	return op;
+}
+
+static void CompileTextOperandsRun (FilterProgram* program, FilterOperand* op, FilterOperand* last, 
+                                    int runOp, int* depth)
+{
+	IntArray literalSet;
+	IntArrayInit(&literalSet, 8);
+	while(TRUE)
+	{
+		IntArrayAdd(&literalSet, AddProgramLiteral(program, op->value));
+		if (op == last)
+			break;
+		op = op->sibling->sibling;
+	}
+	g_array_append_val(program->literalSets, literalSet);
+	EmitInstruction(program, (runOp == ovOR) ? fiAnyText : fiAllText, program->literalSets->len - 1, depth);
+}
+
+/* Follows the evaluation order of NodeIsFiltered; an AND or OR skips its right operand 
+ * when the result is already known. The runs of text operands joined by the same operator 
+ * are tested at once. */
+static void CompileNode (FilterProgram* program, FilterOperand* op, int* depth)
+{
+	int empty = TRUE;
+	int curentOp = ovNone;
+	while(op != NULL)
+	{
+		if (op->value != NULL || op->operator == ovGroup || op->operator == ovNOTGroup)
+		{
+			int skip = -1, negate = FALSE, runOp = curentOp, runLength = 0;
+			FilterOperand *runLast = NULL;
+			
+			if (IsTextOperand(op))
+			{
+				if (runOp == ovNone && op->sibling != NULL)
+					runOp = op->sibling->operator;
+				if (runOp == ovAND || runOp == ovOR)
+					runLast = GetTextOperandsRun(op, runOp, &runLength);
+			}
+			if (curentOp == ovNone)
+			{
+				if (!empty)
+					EmitInstruction(program, fiDrop, 0, depth);
+			}else
+			{
+				if (empty)
+					EmitInstruction(program, fiTrue, 0, depth);
+				skip = program->code->len;
+				EmitInstruction(program, (curentOp == ovAND) ? fiSkipIfFalse : fiSkipIfTrue, 0, depth);
+			}
+			
+			if (runLength > 1)
+			{
+				/* acc OR a OR b is acc OR (a OR b) */
+				CompileTextOperandsRun(program, op, runLast, runOp, depth);
+			}else if (op->value != NULL)
+			{
+				CompileOperand(program, op, depth);
+				negate = (op->operator == ovNOT);
+			}else
+			{
+				CompileNode(program, op->child, depth);
+				negate = (op->operator == ovNOTGroup);
+			}
+			if (negate)
+				EmitInstruction(program, fiNot, 0, depth);
+			
+			if (skip >= 0)
+			{
+				EmitInstruction(program, (curentOp == ovAND) ? fiAnd : fiOr, 0, depth);
+				g_array_index(program->code, FilterInstruction, skip).arg = program->code->len - skip - 1;
+			}
+			if (runLength > 1)
+			{
+				op = runLast;
+				curentOp = runOp;
+			}
+			empty = FALSE;
+		}else if (op->operator == ovAND || op->operator == ovOR)
+		{
+			curentOp = op->operator;
+		}else 
+			g_assert(0);
+		
+		op = op->sibling;
+	}
+	if (empty)
+		EmitInstruction(program, fiTrue, 0, depth);
+}
+
+static void BuildTextMatcher (TextMatcher* matcher, GPtrArray* literals, int foldCase)
+{
+	IntArray transitions, outputs;
+	int *fail, *queue, *firstLiteral, *nextLiteral;
+	int classes, i, head, tail;
+	
+	/* the byte classes; a folded literal matches both cases of its letters */
+	memset(matcher->byteClass, 0, sizeof(matcher->byteClass));
+	classes = 1;
+	for (i=0; i<literals->len; i++)
+	{
+		const guint8 *p;
+		for (p = (const guint8*)g_ptr_array_index(literals, i); *p != '\0'; p++)
+			if (matcher->byteClass[*p] == 0)
+			{
+				ERROR_IF(classes > 255);
+				matcher->byteClass[*p] = classes;
+				if (foldCase)
+					matcher->byteClass[(guint8)g_ascii_toupper(*p)] = classes;
+				classes++;
+			}
+	}
+	matcher->classesNumber = classes;
+	
+	/* the trie of the literals; -1 for the missing transitions */
+	IntArrayInit(&transitions, classes * 8);
+	for (i=0; i<classes; i++)
+		IntArrayAdd(&transitions, -1);
+	matcher->statesNumber = 1;
+	nextLiteral = (int*)g_malloc(sizeof(int) * (literals->len + 1));
+	for (i=0; i<literals->len; i++)
+	{
+		const guint8 *p;
+		int state = 0;
+		for (p = (const guint8*)g_ptr_array_index(literals, i); *p != '\0'; p++)
+		{
+			int transition = state * classes + matcher->byteClass[*p];
+			if (transitions.data[transition] < 0)
+			{
+				int j;
+				for (j=0; j<classes; j++)
+					IntArrayAdd(&transitions, -1);
+				transitions.data[transition] = matcher->statesNumber++;
+			}
+			state = transitions.data[transition];
+		}
+		nextLiteral[i] = state; /*the end state until linked below*/
+	}
+	
+	/* the literals ending in each state of the trie */
+	firstLiteral = (int*)g_malloc(sizeof(int) * matcher->statesNumber);
+	for (i=0; i<matcher->statesNumber; i++)
+		firstLiteral[i] = -1;
+	for (i=literals->len-1; i>=0; i--)
+	{
+		int state = nextLiteral[i];
+		nextLiteral[i] = firstLiteral[state];
+		firstLiteral[state] = i;
+	}
+	
+	/* breadth first: a missing transition goes where the longest suffix of the state goes */
+	fail = (int*)g_malloc0(sizeof(int) * matcher->statesNumber);
+	queue = (int*)g_malloc(sizeof(int) * matcher->statesNumber);
+	head = tail = 0;
+	queue[tail++] = 0;
+	while (head < tail)
+	{
+		int state = queue[head++], c;
+		for (c=0; c<classes; c++)
+		{
+			int *transition = transitions.data + state * classes + c;
+			if (*transition >= 0)
+			{
+				fail[*transition] = (state == 0) ? 0 : transitions.data[fail[state] * classes + c];
+				queue[tail++] = *transition;
+			}else
+				*transition = (state == 0) ? 0 : transitions.data[fail[state] * classes + c];
+		}
+	}
+	g_assert(tail == matcher->statesNumber);
+	
+	/* the outputs of a state: its literals and the ones of its longest suffix state */
+	matcher->outputStart = (int*)g_malloc0(sizeof(int) * matcher->statesNumber);
+	matcher->outputCount = (int*)g_malloc0(sizeof(int) * matcher->statesNumber);
+	IntArrayInit(&outputs, literals->len + 2);
+	for (i=0; i<tail; i++)
+	{
+		int state = queue[i], literal, j;
+		matcher->outputStart[state] = outputs.len;
+		for (literal = firstLiteral[state]; literal >= 0; literal = nextLiteral[literal])
+			IntArrayAdd(&outputs, literal);
+		if (state != 0)
+			for (j=0; j<matcher->outputCount[fail[state]]; j++)
+				IntArrayAdd(&outputs, outputs.data[matcher->outputStart[fail[state]] + j]);
+		matcher->outputCount[state] = outputs.len - matcher->outputStart[state];
+	}
+	
+	for (i=0; i<transitions.len; i++)
+	{
+		int state = transitions.data[i];
+		transitions.data[i] = (matcher->outputCount[state] > 0) ? -state * classes : state * classes;
+	}
+	matcher->transitions = transitions.data;
+	matcher->outputs = outputs.data;
+	g_free(fail);
+	g_free(queue);
+	g_free(firstLiteral);
+	g_free(nextLiteral);
+}
+
+/* Sets in matches the bits of the literals found in text */
+static void MatchLiterals (const TextMatcher* matcher, const char* text, guint32* matches, int literalsNumber)
+{
+	const guint8 *p;
+	int row = 0, remaining = literalsNumber;
+	for (p = (const guint8*)text; *p != '\0'; p++)
+	{
+		row = matcher->transitions[row + matcher->byteClass[*p]];
+		if (row < 0)
+		{
+			int state = (row = -row) / matcher->classesNumber;
+			const int *output = matcher->outputs + matcher->outputStart[state];
+			const int *outputEnd = output + matcher->outputCount[state];
+			for (; output < outputEnd; output++)
+			{
+				guint32 bit = 1u << (*output % 32);
+				if ((matches[*output / 32] & bit) == 0)
+				{
+					matches[*output / 32] |= bit;
+					if (--remaining == 0)
+						return;
+				}
+			}
+		}
+	}
+}
+
+FilterProgram* CompileFilter (Filter* filter, int caseSensitivity)
+{
+	FilterProgram *program = (FilterProgram*)g_malloc0(sizeof(FilterProgram));
+	int depth = 0, i, j;
+	g_assert(caseSensitivity >= casSensitive);
+	
+	program->code = g_array_new(FALSE, FALSE, sizeof(FilterInstruction));
+	program->terms = g_array_new(FALSE, FALSE, sizeof(FilterTerm));
+	program->literals = g_ptr_array_new();
+	program->literalIndexes = g_hash_table_new(g_str_hash, g_str_equal);
+	program->literalSets = g_array_new(FALSE, FALSE, sizeof(IntArray));
+	program->caseSensitivity = caseSensitivity;
+	
+	CompileNode(program, filter, &depth);
+	g_assert(depth == 1);
+	
+	program->matchWords = (program->literals->len + 31) / 32;
+	program->literalSetMasks = (guint32*)g_malloc0(sizeof(guint32) * 
+	                                               MAX(program->matchWords * program->literalSets->len, 1));
+	for (i=0; i<program->literalSets->len; i++)
+	{
+		IntArray *literalSet = &g_array_index(program->literalSets, IntArray, i);
+		guint32 *mask = program->literalSetMasks + i * program->matchWords;
+		for (j=0; j<literalSet->len; j++)
+			mask[literalSet->data[j] / 32] |= 1u << (literalSet->data[j] % 32);
+		IntArrayFreeInternal(literalSet);
+	}
+	g_array_free(program->literalSets, TRUE);
+	program->literalSets = NULL;
+	g_hash_table_destroy(program->literalIndexes);
+	program->literalIndexes = NULL;
+	BuildTextMatcher(&program->matcher, program->literals, caseSensitivity != casSensitive);
+	return program;
+}
+
+static int LiteralSetIsFiltered (const guint32* mask, const guint32* matches, int matchWords, int all)
+{
+	int i;
+	for (i=0; i<matchWords; i++)
+	{
+		if (all && (matches[i] & mask[i]) != mask[i])
+			return FALSE;
+		if (!all && (matches[i] & mask[i]) != 0)
+			return TRUE;
+	}
+	return all;
+}
+
+int RunFilterProgram (FilterProgram* program, const char* entryText, NetConnection* conn)
+{
+	guint32 localMatches[PROGRAM_LOCAL_MATCH_WORDS], *matches = localMatches;
+	char localStack[PROGRAM_LOCAL_STACK], *stack = localStack;
+	int matchWords = program->matchWords;
+	int scanned = FALSE, top = -1, pc, filtered;
+	g_assert(entryText != NULL && conn != NULL);
+	
+	if (matchWords > PROGRAM_LOCAL_MATCH_WORDS)
+		matches = (guint32*)g_malloc(sizeof(guint32) * matchWords);
+	if (program->maxStack > PROGRAM_LOCAL_STACK)
+		stack = (char*)g_malloc(program->maxStack);
+	
+	for (pc=0; pc<program->code->len; pc++)
+	{
+		const FilterInstruction *instruction = &g_array_index(program->code, FilterInstruction, pc);
+		switch(instruction->code)
+		{
+			case fiTrue:
+				stack[++top] = TRUE;
+				break;
+			case fiText:
+			case fiAnyText:
+			case fiAllText:
+				if (!scanned)
+				{
+					/* all the literals at once, only when one is needed; the libc search 
+					 * is faster for a single one */
+					memset(matches, 0, sizeof(guint32) * matchWords);
+					if (program->literals->len == 1)
+						matches[0] = (program->caseSensitivity == casSensitive) ?
+							(strstr(entryText, g_ptr_array_index(program->literals, 0)) != NULL) :
+							(strcasestr(entryText, g_ptr_array_index(program->literals, 0)) != NULL);
+					else
+						MatchLiterals(&program->matcher, entryText, matches, program->literals->len);
+					scanned = TRUE;
+				}
+				if (instruction->code == fiText)
+					stack[++top] = ((matches[instruction->arg / 32] >> (instruction->arg % 32)) & 1);
+				else
+					stack[++top] = LiteralSetIsFiltered(program->literalSetMasks + instruction->arg * matchWords, 
+					                                    matches, matchWords, instruction->code == fiAllText);
+				break;
+			case fiTerm:
+				stack[++top] = TermIsFiltered(&g_array_index(program->terms, FilterTerm, instruction->arg), conn);
+				break;
+			case fiNot:
+				stack[top] = !stack[top];
+				break;
+			case fiDrop:
+				top--;
+				break;
+			case fiAnd:
+				top--;
+				stack[top] = (stack[top] && stack[top + 1]);
+				break;
+			case fiOr:
+				top--;
+				stack[top] = (stack[top] || stack[top + 1]);
+				break;
+			case fiSkipIfFalse:
+				if (!stack[top])
+					pc += instruction->arg;
+				break;
+			case fiSkipIfTrue:
+				if (stack[top])
+					pc += instruction->arg;
+				break;
+			default:
+				g_assert(0);
+		}
+	}
+	g_assert(top == 0);
+	filtered = stack[0];
+	
+	if (matches != localMatches)
+		g_free(matches);
+	if (stack != localStack)
+		g_free(stack);
+	return filtered;
+}
+
+int FilterProgramUsesText (FilterProgram* program)
+{
+	return (program->literals->len > 0);
+}
+
+void FreeFilterProgram (FilterProgram* program)
+{
+	int i;
+	if (program == NULL)
+		return;
+	g_array_free(program->code, TRUE);
+	for (i=0; i<program->terms->len; i++)
+		UnrefTermData(&g_array_index(program->terms, FilterTerm, i));
+	g_array_free(program->terms, TRUE);
+	for (i=0; i<program->literals->len; i++)
+		g_free(g_ptr_array_index(program->literals, i));
+	g_ptr_array_free(program->literals, TRUE);
+	g_free(program->literalSetMasks);
+	g_free(program->matcher.transitions);
+	g_free(program->matcher.outputStart);
+	g_free(program->matcher.outputCount);
+	g_free(program->matcher.outputs);
+	g_free(program);
+}
+
+
+
 char* PreParseFilter (const char* filter)
 {
 	int len = 0;
@@ -18,14 +18,51 @@
 #ifndef NACTV_FILTER_H
 #define NACTV_FILTER_H
 
+#include "net.h"
+#include "prefixtrie.h"
+
 enum OperatorValues { ovNone, ovAND, ovOR, ovGroup, ovNOTGroup, ovNOT };
 enum OperatorChar   { ocNone = 48, ocIgnored, ocFreeString/*2*/, ocQuoteString, ocQuote/*4*/, ocOR, ocNOT, ocStartGroup/*7*/, ocEndGroup };
 
+enum FilterTermField { ftfPort, ftfLocalPort, ftfRemotePort, ftfAddress, ftfLocalAddress, ftfRemoteAddress, 
+                       ftfState, ftfProtocol, ftfPid, ftfProgram };
+
+#define FILTER_TERM_PROGRAM_LEN 64
+
+enum { FILTER_PORT_SET_TCP, FILTER_PORT_SET_UDP };
+
+/* The ports of a port list operand, a bit per port for tcp and udp; shared by the term copies */
+typedef struct
+{
+	volatile gint refCount;
+	guint32 bits[2][65536 / 32];
+} FilterPortSet;
+
+/* An unquoted operand naming a connection field, with operators: port:80, lport:1024-2048, 
+ * raddr:10.0.0.0/8, addr:::1, state:listen, proto:udp, pid:1234, prog:nginx. Compared with 
+ * the connection, not the text. The port fields also take a list of ports and ranges, 
+ * possibly of one protocol, port:udp/53,80,8000-8100. The address fields also take a list 
+ * of prefixes, raddr:10.64.0.0/10,2001:db8::/32, or a prefix list file, raddr:@/path/file. */
+typedef struct
+{
+	int field;
+	int portLow, portHigh;
+	FilterPortSet *portSet; /*the list of ports; NULL for one range*/
+	NetAddress address;
+	int prefixLen;
+	PrefixTrie *prefixes; /*the list of prefixes; NULL for one prefix*/
+	int state;
+	guint protocols; /*mask of 1<<NC_PROTOCOL_...; tcp and udp include tcp6 and udp6*/
+	long pid;
+	char program[FILTER_TERM_PROGRAM_LEN]; /*the whole name, any case*/
+} FilterTerm;
+
 typedef struct _FilterOperand FilterOperand;
 
 struct _FilterOperand
 {
 	char *value;
+	FilterTerm *term; /*NULL for text operands*/
 	int operator;
 	FilterOperand *sibling;
 	FilterOperand *child;
@@ -39,6 +76,25 @@ char* PreParseFilter (const char* filterText);
 Filter* ParseFilter (const char* filterText, char **filterMask);
 Filter* ParseFilterNoOperators (const char* filterText);
 int IsFiltered (const char* entryText, Filter* filter, int caseSensitivity);
+/* The field operands are compared with conn; the text operands with entryText */
+int IsConnectionFiltered (const char* entryText, NetConnection* conn, Filter* filter, int caseSensitivity);
+
+/* A filter compiled for evaluating many entries: a flat postfix program whose text operands 
+ * are all searched in one pass over the entry text */
+typedef struct _FilterProgram FilterProgram;
+
+/* casInsensitiveLibc folds only the ASCII letters */
+FilterProgram* CompileFilter (Filter* filter, int caseSensitivity);
+/* Like IsConnectionFiltered */
+int RunFilterProgram (FilterProgram* program, const char* entryText, NetConnection* conn);
+/* FALSE if the program has no text operands: the entry text is not needed */
+int FilterProgramUsesText (FilterProgram* program);
+void FreeFilterProgram (FilterProgram* program);
+
+/* Returns the sockets that can pass the filter (a superset) or NULL if all can */
+NetSocketFilter* GetFilterSocketFilter (Filter* filter);
+/* TRUE if the filter compares the connections pid or program */
+int FilterUsesProcesses (Filter* filter);
 
 Filter* AddFilterOperand (Filter *filter, int binOperator, int isNot, const char *operandText);
 FilterOperand* AddOperand (FilterOperand *operand, int binOperator, int isNot, const char *operandText);
@@ -0,0 +1,293 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#include "nactv-debug.h"
+#include "hostcache.h"
+#include "utils.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <glib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/* The estimated allocation overhead of an entry: the hash table node and the malloc headers */
+#define HOST_CACHE_ENTRY_OVERHEAD (4*sizeof(gpointer) + 3*2*sizeof(gsize))
+
+#define HOST_CACHE_FILE_MAGIC "NACTVHC1"
+#define HOST_CACHE_FILE_SLOTS 16384
+#define HOST_CACHE_FILE_MAX_PROBES 16
+#define HOST_RECORD_ADDRESS_SIZE 48
+#define HOST_RECORD_NAME_SIZE 200 /*the longer names are not saved*/
+
+typedef struct
+{
+	char magic[8];
+	guint32 slots;
+	guint32 record_size;
+	guint8 reserved[48];
+} HostCacheFileHeader;
+
+/* The records of an address are in the HOST_CACHE_FILE_MAX_PROBES slots following its hash. 
+ * The slots are never emptied, only reused, so a lookup ends at the first empty slot. */
+typedef struct
+{
+	gint64 expires; /*the time() of expiry, 0 for an empty slot*/
+	char address[HOST_RECORD_ADDRESS_SIZE];
+	char host[HOST_RECORD_NAME_SIZE]; /*empty for an address without name*/
+} HostCacheRecord;
+
+typedef struct
+{
+	GList link; /*in the LRU list, data is the entry*/
+	char *address;
+	char *host; /*NULL for an address without name*/
+	double expires; /*on the cache timer*/
+	gsize memory;
+} HostCacheEntry;
+
+struct _HostCache
+{
+	GHashTable *entries; /*HostCacheEntry by address*/
+	GQueue lru; /*the most recently used first*/
+	GTimer *timer;
+	gsize max_memory;
+	int positive_ttl, negative_ttl;
+	HostCacheStats stats;
+	HostCacheRecord *file_records; /*NULL without cache file*/
+	gsize file_size;
+};
+
+
+static void host_cache_entry_free (gpointer data)
+{
+	HostCacheEntry *entry = (HostCacheEntry*)data;
+	g_free(entry->address);
+	g_free(entry->host);
+	g_free(entry);
+}
+
+HostCache *host_cache_new (gsize max_memory, int positive_ttl, int negative_ttl)
+{
+	HostCache *cache = g_new0(HostCache, 1);
+	cache->entries = g_hash_table_new_full(&g_str_hash, &g_str_equal, NULL, &host_cache_entry_free);
+	g_queue_init(&cache->lru);
+	cache->timer = g_timer_new();
+	cache->max_memory = max_memory;
+	cache->positive_ttl = positive_ttl;
+	cache->negative_ttl = negative_ttl;
+	return cache;
+}
+
+void host_cache_free (HostCache *cache)
+{
+	if (cache == NULL)
+		return;
+	g_hash_table_destroy(cache->entries);
+	g_timer_destroy(cache->timer);
+	if (cache->file_records != NULL)
+		munmap((char*)cache->file_records - sizeof(HostCacheFileHeader), cache->file_size);
+	g_free(cache);
+}
+
+static void host_cache_remove (HostCache *cache, HostCacheEntry *entry)
+{
+	g_queue_unlink(&cache->lru, &entry->link);
+	cache->stats.memory -= entry->memory;
+	cache->stats.entries--;
+	g_hash_table_remove(cache->entries, entry->address); /*frees entry*/
+}
+
+gboolean host_cache_open_file (HostCache *cache, const char *path)
+{
+	HostCacheFileHeader *header;
+	gsize size = sizeof(HostCacheFileHeader) + HOST_CACHE_FILE_SLOTS * sizeof(HostCacheRecord);
+	struct stat st;
+	int fd;
+	
+	g_assert(cache->file_records == NULL);
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		nactv_trace("host cache file %s error %d\n", path, errno);
+		if (fd >= 0)
+			close(fd);
+		return FALSE;
+	}
+	if ((gsize)st.st_size != size && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0))
+	{
+		nactv_trace("host cache file %s resize error %d\n", path, errno);
+		close(fd);
+		return FALSE;
+	}
+	header = (HostCacheFileHeader*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED)
+	{
+		nactv_trace("host cache file %s map error %d\n", path, errno);
+		return FALSE;
+	}
+	
+	if (memcmp(header->magic, HOST_CACHE_FILE_MAGIC, sizeof(header->magic)) != 0 || 
+	    header->slots != HOST_CACHE_FILE_SLOTS || header->record_size != sizeof(HostCacheRecord))
+	{
+		memset(header, 0, size);
+		header->slots = HOST_CACHE_FILE_SLOTS;
+		header->record_size = sizeof(HostCacheRecord);
+		memcpy(header->magic, HOST_CACHE_FILE_MAGIC, sizeof(header->magic));
+	}
+	cache->file_records = (HostCacheRecord*)(header + 1);
+	cache->file_size = size;
+	return TRUE;
+}
+
+/* The file is shared by the running instances; a record written at the same time by another 
+ * one may be torn, so its texts are checked */
+static gboolean host_record_matches (const HostCacheRecord *record, const char *address)
+{
+	return (strncmp(record->address, address, sizeof(record->address)) == 0 && 
+	        memchr(record->host, '\0', sizeof(record->host)) != NULL);
+}
+
+static HostCacheRecord *host_cache_file_find (HostCache *cache, const char *address)
+{
+	unsigned int slot = g_str_hash(address) % HOST_CACHE_FILE_SLOTS;
+	int i;
+	
+	for (i=0; i<HOST_CACHE_FILE_MAX_PROBES; i++, slot = (slot + 1) % HOST_CACHE_FILE_SLOTS)
+	{
+		HostCacheRecord *record = &cache->file_records[slot];
+		if (record->expires == 0)
+			break;
+		if (host_record_matches(record, address))
+			return record;
+	}
+	return NULL;
+}
+
+/* Writes over the record of address, else over the first expired record or the one 
+ * expiring first */
+static void host_cache_file_write (HostCache *cache, const char *address, const char *host, 
+                                   gint64 expires)
+{
+	unsigned int slot = g_str_hash(address) % HOST_CACHE_FILE_SLOTS;
+	HostCacheRecord *record = host_cache_file_find(cache, address);
+	gint64 now = time(NULL);
+	int i;
+	
+	if (strlen(address) >= sizeof(record->address) || 
+	    (host != NULL && strlen(host) >= sizeof(record->host)))
+		return;
+	for (i=0; record == NULL && i<HOST_CACHE_FILE_MAX_PROBES; i++)
+	{
+		HostCacheRecord *candidate = &cache->file_records[(slot + i) % HOST_CACHE_FILE_SLOTS];
+		if (candidate->expires <= now)
+			record = candidate;
+	}
+	if (record == NULL)
+	{
+		record = &cache->file_records[slot];
+		for (i=1; i<HOST_CACHE_FILE_MAX_PROBES; i++)
+		{
+			HostCacheRecord *candidate = &cache->file_records[(slot + i) % HOST_CACHE_FILE_SLOTS];
+			if (candidate->expires < record->expires)
+				record = candidate;
+		}
+	}
+	
+	n_strlcpy(record->address, address, sizeof(record->address));
+	n_strlcpy(record->host, (host != NULL) ? host : "", sizeof(record->host));
+	record->expires = expires;
+}
+
+static void host_cache_add (HostCache *cache, const char *address, const char *host, int ttl)
+{
+	HostCacheEntry *entry = (HostCacheEntry*)g_hash_table_lookup(cache->entries, address);
+	
+	if (entry != NULL)
+		host_cache_remove(cache, entry);
+	
+	entry = g_new0(HostCacheEntry, 1);
+	entry->link.data = entry;
+	entry->address = g_strdup(address);
+	entry->host = g_strdup(host);
+	entry->expires = g_timer_elapsed(cache->timer, NULL) + ttl;
+	entry->memory = sizeof(HostCacheEntry) + HOST_CACHE_ENTRY_OVERHEAD + strlen(address) + 1 + 
+		((host != NULL) ? strlen(host) + 1 : 0);
+	g_hash_table_insert(cache->entries, entry->address, entry);
+	g_queue_push_head_link(&cache->lru, &entry->link);
+	cache->stats.memory += entry->memory;
+	cache->stats.entries++;
+	
+	while (cache->stats.memory > cache->max_memory && cache->lru.tail != &entry->link)
+	{
+		host_cache_remove(cache, (HostCacheEntry*)cache->lru.tail->data);
+		cache->stats.evictions++;
+	}
+}
+
+gboolean host_cache_lookup (HostCache *cache, const char *address, const char **host)
+{
+	HostCacheEntry *entry = (HostCacheEntry*)g_hash_table_lookup(cache->entries, address);
+	
+	if (entry != NULL && entry->expires <= g_timer_elapsed(cache->timer, NULL))
+	{
+		host_cache_remove(cache, entry);
+		entry = NULL;
+		cache->stats.expirations++;
+	}
+	if (entry == NULL && cache->file_records != NULL)
+	{
+		const HostCacheRecord *record = host_cache_file_find(cache, address);
+		gint64 ttl = (record != NULL) ? record->expires - time(NULL) : 0;
+		if (ttl > 0)
+		{
+			host_cache_add(cache, address, (record->host[0] != '\0') ? record->host : NULL, 
+			               (int)MIN(ttl, G_MAXINT));
+			entry = (HostCacheEntry*)g_hash_table_lookup(cache->entries, address);
+			cache->stats.file_hits++;
+		}
+	}
+	if (entry == NULL)
+	{
+		cache->stats.misses++;
+		return FALSE;
+	}
+	
+	cache->stats.hits++;
+	g_queue_unlink(&cache->lru, &entry->link);
+	g_queue_push_head_link(&cache->lru, &entry->link);
+	*host = entry->host;
+	return TRUE;
+}
+
+void host_cache_insert (HostCache *cache, const char *address, const char *host)
+{
+	int ttl = (host != NULL) ? cache->positive_ttl : cache->negative_ttl;
+	host_cache_add(cache, address, host, ttl);
+	if (cache->file_records != NULL)
+		host_cache_file_write(cache, address, host, (gint64)time(NULL) + ttl);
+}
+
+void host_cache_get_stats (const HostCache *cache, HostCacheStats *stats)
+{
+	*stats = cache->stats;
+}
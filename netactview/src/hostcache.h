@@ -0,0 +1,54 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#ifndef NACTV_HOSTCACHE_H
+#define NACTV_HOSTCACHE_H
+
+#include <glib.h>
+
+/* The host names by address, with the least recently used entries evicted past a memory 
+ * limit. The names expire after the positive TTL and the addresses without name after the 
+ * negative TTL. The cache is not locked.
+ * An optional file keeps the entries between runs: a memory mapped hash table looked up 
+ * on the misses and updated on each insert. */
+typedef struct _HostCache HostCache;
+
+typedef struct
+{
+	guint64 hits, misses, expirations, evictions;
+	guint64 file_hits; /*counted in hits too*/
+	unsigned int entries;
+	gsize memory; /*an estimate of the bytes used by the entries*/
+} HostCacheStats;
+
+/* The TTLs are in seconds */
+HostCache *host_cache_new (gsize max_memory, int positive_ttl, int negative_ttl);
+void host_cache_free (HostCache *cache);
+
+/* Maps the cache file, created or reset if it is not valid. Returns FALSE if it can't be used. */
+gboolean host_cache_open_file (HostCache *cache, const char *path);
+
+/* Returns TRUE if address has an entry that is not expired, with its name in host (NULL for 
+ * an address without name). host is valid until the next change of the cache. */
+gboolean host_cache_lookup (HostCache *cache, const char *address, const char **host);
+/* host is NULL for an address without name; the entry of address is replaced */
+void host_cache_insert (HostCache *cache, const char *address, const char *host);
+
+void host_cache_get_stats (const HostCache *cache, HostCacheStats *stats);
+
+
+#endif /*NACTV_HOSTCACHE_H*/
@@ -19,6 +19,9 @@
 #include "net.h"
 #include "utils.h"
 #include "filter.h"
+#include "prefixtrie.h"
+#include "resolver.h"
+#include "hostcache.h"
 #include "mainwindow.h"
 #include "definitions.h"
 
@@ -71,13 +74,12 @@ typedef enum
 	MVC_PID,
 	MVC_PROGRAMNAME,
 	MVC_PROGRAMCOMMAND,
-	MVC_VISIBLE,
 	MVC_DATA,
 	MVC_COLOR,
 	MVC_COLUMNSNUMBER
 } ColumnIndex;
 
-#define MVC_DATA_COLUMNSNUMBER 3
+#define MVC_DATA_COLUMNSNUMBER 2
 #define MVC_VIEW_COLUMNSNUMBER (MVC_COLUMNSNUMBER-MVC_DATA_COLUMNSNUMBER)
 
 typedef struct
@@ -115,9 +117,16 @@ typedef enum
 typedef struct 
 {
 	GtkTreeIter *iter;
+	unsigned int row; /*the index in connections and in the visibility bitsets*/
 	ListLineState state;
 	GTimer *addedtime;
 	GTimer *closedtime;
+	/* the visible columns text; for case insensitive filters casefolded if not ASCII, the 
+	 * ASCII letters being folded by the filter program */
+	char *filter_text;
+	unsigned int filter_text_generation;
+	unsigned int filter_job_id; /*the evaluation holding the row; 0 after the row changed*/
+	int filter_job_row;
 } ListLineUserData;
 
 
@@ -125,13 +134,16 @@ typedef struct
 #define DEFAULT_CLOSED_COLOR "red"
 #define DEFAULT_NEW_SHOW_INT 3
 #define DEFAULT_NEW_COLOR "green"
+#define DEFAULT_SUBNET_COLOR "yellow"
+#define SUBNETS_FILE_NAME ".netactview-subnets"
+#define HOST_CACHE_FILE_NAME ".netactview-hostcache"
 
 typedef struct
 {
 	GtkTreeView *main_view;
 	GtkListStore *main_store;
 	GtkTreeModel *main_store_filtered;
-	GtkLabel *label_count, *label_sent, *label_received, *label_visible;
+	GtkLabel *label_count, *label_sent, *label_received, *label_visible, *label_refresh;
 	GtkMenu *mainPopup;
 	GtkTreeViewColumn *last_popup_column;
 	/*Associates the data store index with the graphical column*/
@@ -139,12 +151,32 @@ typedef struct
 	GHashTable *column_to_index_hash;
 
 	GArray *connections;
+	/* Bitsets parallel to connections. A row is visible if it passes the filter and it is 
+	 * established or the unestablished connections are shown; closed rows are not established. */
+	gulong *filtered_rows, *established_rows, *visible_rows;
+	unsigned int rows_words; /*the allocated words of each bitset*/
+	unsigned int nvisible_rows;
 	gboolean auto_refresh;
 	unsigned auto_refresh_interval, auto_refresh_id;
+	/* The refresh periods of the other data (ms); the connections follow auto_refresh_interval */
+	int attribution_period, processes_period, statistics_period;
+	/* While the window can't be seen only the statistics are refreshed, every background_period */
+	gboolean background_refresh;
+	int background_period;
+	guint statistics_refresh_id; /*0 without auto refresh; the statistics follow the refreshes then*/
+	/* The adaptive auto refresh changes auto_refresh_interval to keep the CPU use of 
+	 * netactview under cpu_budget (percent of one CPU) */
+	gboolean adaptive_refresh;
+	int cpu_budget;
+	GTimer *governor_timer; /*since the last interval update; NULL before the first*/
+	double governor_cpu_time;
+	/* The refreshes since the last interval update and the rows they changed */
+	unsigned int changed_refreshes, unchanged_refreshes, refresh_changes;
 	gchar sel_arinterval_menu[128];
 	gboolean view_local_host, view_remote_host, view_local_address, view_port_names;
 	gboolean view_unestablished_connections, view_command;
 	gboolean view_colors;
+	PrefixTrie *subnet_colors; /*the rows background by subnet; NULL without subnets file*/
 	gboolean show_closed_connections;
 	gboolean update_disabled, main_view_created, restart_requested;
 	volatile gboolean exit_requested;
@@ -153,16 +185,48 @@ typedef struct
 	int current_sort_column;
 	int current_sort_direction;
 
-	GHashTable *ip_host_hash, *requested_ip_hash;
-	GThreadPool *host_loader_pool;
+	HostCache *host_cache;
+	GHashTable *requested_ip_hash;
+	/* The rows without the host of an address: sets of NetConnection* by address */
+	GHashTable *pending_host_rows;
+	/* Answered by the resolver and not applied to the rows yet; under host_hash_lock */
+	GPtrArray *resolved_addresses;
+	guint resolved_hosts_id;
+	/* The answers added to resolved_addresses (under host_hash_lock) and taken from it */
+	guint64 resolved_answers, drained_answers;
+	/* resolved_answers when the hosts of latest_connections were looked up; under loaded_conn_lock. 
+	 * The pending hosts of the appended rows are not looked up again while no later answer 
+	 * was applied (stamped_hosts_valid). */
+	guint64 latest_stamped_answers;
+	gboolean stamped_hosts_valid;
+	Resolver *host_resolver;
+	guint host_priority_id; /*the delayed update of the host requests priorities*/
 	GMutex *host_hash_lock;
-	
-	GThread *data_load_thread;
+	ResolverOptions resolver_options; /*from the config file; 0 and NULL for the system settings*/
+	int host_cache_memory; /*KiB*/
+	int host_ttl, host_negative_ttl; /*seconds*/
+	gboolean host_cache_persistent; /*kept in HOST_CACHE_FILE_NAME between runs*/
+	
+	/* The loader stages: the sockets load (data_load_thread), the process file descriptors scan 
+	 * (attribution_thread) and the processes info and hosts (publish_thread), linked by queues 
+	 * of LoadJob. The view applies the published connections. */
+	GThread *data_load_thread, *attribution_thread, *publish_thread;
+	BoundedQueue *attribution_queue, *publish_queue;
 	GMutex *loaded_conn_lock, *refresh_request_lock;
 	GCond *refresh_request_cond;
-	gboolean refresh_requested;
+	gboolean refresh_requested, refresh_forced;
+	NetCollector *collector;
+	/* What the view and the filter can show; view_needs is the last requested. collector_needs 
+	 * is passed to the loader thread when collector_needs_changed; generation counts the changes. */
+	NetCollectorNeeds *view_needs, *collector_needs;
+	gboolean collector_needs_changed;
+	unsigned int needs_generation, loaded_needs_generation, shown_needs_generation;
+	unsigned int skipped_refreshes; /*refreshes with unchanged connections*/
 	NetConnection *latest_connections;
 	unsigned int nr_latest_connections;
+	/* Counts the connections set as latest and the ones shown; different while a load 
+	 * waits to be shown (dropped by an idle callback while the update was disabled) */
+	unsigned int published_loads, shown_loads;
 	
 	NetStatistics statistics, statistics_base;
 	GTimer *statistics_timer;
@@ -171,15 +235,31 @@ typedef struct
 	GString *filter;
 	char *filterMask;
 	Filter *filterTree, *filterTreeNoCase;
-	gboolean caseSensitiveFilter, filterOperators;
+	FilterProgram *filterProgram; /*of the tree matching the case sensitivity*/
+	GArray *filter_columns; /*the visible columns indexes; NULL when the columns changed*/
+	/* The rows filter text is valid if made in the current generation; a new generation 
+	 * starts when the visible columns or the case folding change. */
+	unsigned int filter_text_generation;
+	gboolean filter_text_casefolded;
+	/* The filter applied to the rows visibility */
+	char *applied_filter;
+	gboolean applied_filter_operators, applied_filter_regex, applied_filter_case_sensitive;
+	/* Large tables are filtered on the filter thread; filter_job is the evaluation in progress */
+	GThreadPool *filter_pool;
+	struct _FilterJob *filter_job;
+	unsigned int filter_job_id;
+	guint filter_update_id; /*the delayed update after the filter text changed*/
+	gboolean caseSensitiveFilter, filterOperators, filterRegex;
+	GRegex *regexFilter; /*NULL if the regular expression is not valid*/
 	
 	int columns_initial_view_order[MVC_VIEW_COLUMNSNUMBER]; /* [position] = index. */ 
 	
 	char *default_fixed_font;
-	gboolean first_refresh, manual_refresh;
+	gboolean first_refresh, manual_refresh, needs_changed_refresh;
 
 	int window_width, window_height, initial_window_width, initial_window_height;
 	gboolean window_maximized;
+	gboolean window_iconified, window_unmapped, window_obscured;
 } MainWindowData;
 
 static void set_main_window_data_defaults (MainWindowData *m)
@@ -190,6 +270,12 @@ static void set_main_window_data_defaults (MainWindowData *m)
 	m->auto_refresh = TRUE;
 	m->auto_refresh_interval = 1000;
 	m->auto_refresh_id = 0;
+	m->attribution_period = 1000;
+	m->processes_period = 4000;
+	m->statistics_period = 1000;
+	m->background_period = 10000;
+	m->adaptive_refresh = FALSE;
+	m->cpu_budget = 2;
 	n_strlcpy(m->sel_arinterval_menu, "menuAutoRefresh1", sizeof(m->sel_arinterval_menu));
 	m->view_local_host = FALSE;
 	m->view_remote_host = TRUE;
@@ -208,6 +294,11 @@ static void set_main_window_data_defaults (MainWindowData *m)
 	m->caseSensitiveFilter = TRUE;
 	m->filterOperators = FALSE;
 	
+	m->host_cache_memory = 16*1024;
+	m->host_ttl = 3600;
+	m->host_negative_ttl = 300;
+	m->host_cache_persistent = FALSE;
+	
 	{
 		const int initial_order[MVC_VIEW_COLUMNSNUMBER] = { 
 			MVC_PROTOCOL, MVC_LOCALHOST, MVC_LOCALADDRESS, MVC_LOCALPORT, 
@@ -221,8 +312,12 @@ static void set_main_window_data_defaults (MainWindowData *m)
 static gboolean connection_filtered(NetConnection *conn);
 
 #define VALUE_OR_DEF(s, def) (((s)!=NULL) ? (s) : (def))
-#define connection_visible(conn) ((Mwd.view_unestablished_connections || (conn)->state==NC_TCP_ESTABLISHED) \
-                                  && connection_filtered(conn))
+
+#define ROWS_WORD_BITS (8 * sizeof(gulong))
+#define ROW_WORD(row) ((row) / ROWS_WORD_BITS)
+#define ROW_MASK(row) (1UL << ((row) % ROWS_WORD_BITS))
+#define row_bit(bits, row) (((bits)[ROW_WORD(row)] & ROW_MASK(row)) != 0)
+#define row_visible(row) row_bit(Mwd.visible_rows, row)
 
 extern GladeXML *GladeXml;
 static MainWindowData Mwd;
@@ -255,11 +350,12 @@ static gboolean check_int_range_complete (int *arr, int narr, int range_low, int
 	return result;
 }
 
-static ListLineUserData *list_line_user_data_new (GtkTreeIter *iter)
+/* The iter is set after the row is added to the store */
+static ListLineUserData *list_line_user_data_new (unsigned int row)
 {
 	ListLineUserData *llud;
 	llud = (ListLineUserData*)g_malloc0(sizeof(ListLineUserData));
-	llud->iter = gtk_tree_iter_copy(iter);
+	llud->row = row;
 	llud->addedtime = g_timer_new();
 	llud->state = LLS_NEW;
 	return llud;
@@ -273,112 +369,332 @@ static void list_line_user_data_delete (ListLineUserData *llud)
 		g_timer_destroy(llud->addedtime);
 	if (llud->closedtime!=NULL)
 		g_timer_destroy(llud->closedtime);
+	g_free(llud->filter_text);
 	g_free(llud);
 }
 
-gboolean update_connections_hosts_on_idle(gpointer data);
+static void list_line_invalidate_filter_text (ListLineUserData *llud)
+{
+	g_free(llud->filter_text);
+	llud->filter_text = NULL;
+	llud->filter_job_id = 0; /*evaluated again by the caller*/
+}
 
-#define MAX_HOST_HASH_SIZE 1100100
 
-static void host_loader_thread_func (gpointer data, gpointer user_data)
+static void row_bit_assign (gulong *bits, unsigned int row, gboolean value)
 {
-	char *ip = (char*)data;
-	char *host;
-	
-	host = get_host_name_by_address(ip);
-	if (host==NULL)
-		host = g_strdup("."); /*convention string for no host found*/
-	
-	if (Mwd.exit_requested)
+	if (value)
+		bits[ROW_WORD(row)] |= ROW_MASK(row);
+	else
+		bits[ROW_WORD(row)] &= ~ROW_MASK(row);
+}
+
+/* The bits of the rows past the connections end are 0 */
+static void rows_bits_reserve (unsigned int nrows)
+{
+	unsigned int nwords = ROW_WORD(nrows) + 1;
+	if (nwords > Mwd.rows_words)
 	{
-		g_free(host);
-		return;
+		unsigned int old_words = Mwd.rows_words;
+		Mwd.rows_words = MAX(nwords, 2 * old_words);
+		Mwd.filtered_rows = (gulong*)g_realloc(Mwd.filtered_rows, Mwd.rows_words * sizeof(gulong));
+		Mwd.established_rows = (gulong*)g_realloc(Mwd.established_rows, Mwd.rows_words * sizeof(gulong));
+		Mwd.visible_rows = (gulong*)g_realloc(Mwd.visible_rows, Mwd.rows_words * sizeof(gulong));
+		memset(Mwd.filtered_rows + old_words, 0, (Mwd.rows_words - old_words) * sizeof(gulong));
+		memset(Mwd.established_rows + old_words, 0, (Mwd.rows_words - old_words) * sizeof(gulong));
+		memset(Mwd.visible_rows + old_words, 0, (Mwd.rows_words - old_words) * sizeof(gulong));
 	}
+}
+
+static void rows_bits_free ()
+{
+	g_free(Mwd.filtered_rows);
+	g_free(Mwd.established_rows);
+	g_free(Mwd.visible_rows);
+	Mwd.filtered_rows = Mwd.established_rows = Mwd.visible_rows = NULL;
+	Mwd.rows_words = Mwd.nvisible_rows = 0;
+}
+
+/* The filtered model checks the row visibility again */
+static void emit_row_visibility_changed (unsigned int row)
+{
+	NetConnection *conn = g_array_index(Mwd.connections, NetConnection*, row);
+	ListLineUserData *llud = (ListLineUserData*)conn->user_data;
+	GtkTreePath *path = gtk_tree_model_get_path(GTK_TREE_MODEL(Mwd.main_store), llud->iter);
+	gtk_tree_model_row_changed(GTK_TREE_MODEL(Mwd.main_store), path, llud->iter);
+	gtk_tree_path_free(path);
+}
+
+/* Recomputes the visible rows from the filtered and the established rows a word at a time. 
+ * Only the rows whose visibility flipped are signaled to the filtered model. */
+static void combine_rows_visibility ()
+{
+	unsigned int w, nwords = (Mwd.connections->len + ROWS_WORD_BITS - 1) / ROWS_WORD_BITS;
 	
-	g_mutex_lock(Mwd.host_hash_lock);
+	for (w=0; w<nwords; w++)
+	{
+		gulong visible = Mwd.filtered_rows[w], flipped;
+		if (!Mwd.view_unestablished_connections)
+			visible &= Mwd.established_rows[w];
+		flipped = visible ^ Mwd.visible_rows[w];
+		if (flipped == 0)
+			continue;
+		
+		Mwd.nvisible_rows += __builtin_popcountl(visible);
+		Mwd.nvisible_rows -= __builtin_popcountl(Mwd.visible_rows[w]);
+		Mwd.visible_rows[w] = visible;
+		while (flipped != 0)
+		{
+			emit_row_visibility_changed(w * ROWS_WORD_BITS + g_bit_nth_lsf(flipped, -1));
+			flipped &= flipped - 1;
+		}
+	}
+}
+
+static void combine_row_visibility (unsigned int row)
+{
+	gboolean visible = row_bit(Mwd.filtered_rows, row) && 
+	                   (Mwd.view_unestablished_connections || row_bit(Mwd.established_rows, row));
+	if (visible != row_visible(row))
+	{
+		row_bit_assign(Mwd.visible_rows, row, visible);
+		if (visible)
+			Mwd.nvisible_rows++;
+		else
+			Mwd.nvisible_rows--;
+		emit_row_visibility_changed(row);
+	}
+}
+
+static void update_row_visibility (NetConnection *conn)
+{
+	ListLineUserData *llud = (ListLineUserData*)conn->user_data;
+	row_bit_assign(Mwd.filtered_rows, llud->row, connection_filtered(conn));
+	row_bit_assign(Mwd.established_rows, llud->row, conn->state == NC_TCP_ESTABLISHED);
+	combine_row_visibility(llud->row);
+}
+
+/* Removes the row from connections; the last row takes its place */
+static void remove_connection_row (unsigned int row)
+{
+	unsigned int last = Mwd.connections->len - 1;
 	
-	/* just enforcing the limit, no cache management
-	 * normal usage patterns for a netactview instance are not more than a few hours long */
-	if (g_hash_table_size(Mwd.ip_host_hash) >= MAX_HOST_HASH_SIZE)
+	if (row_visible(row))
+		Mwd.nvisible_rows--;
+	if (row != last)
 	{
-		g_hash_table_destroy(Mwd.ip_host_hash);
-		Mwd.ip_host_hash = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &g_free);
+		NetConnection *moved = g_array_index(Mwd.connections, NetConnection*, last);
+		((ListLineUserData*)moved->user_data)->row = row;
+		row_bit_assign(Mwd.filtered_rows, row, row_bit(Mwd.filtered_rows, last));
+		row_bit_assign(Mwd.established_rows, row, row_bit(Mwd.established_rows, last));
+		row_bit_assign(Mwd.visible_rows, row, row_visible(last));
 	}
+	row_bit_assign(Mwd.filtered_rows, last, FALSE);
+	row_bit_assign(Mwd.established_rows, last, FALSE);
+	row_bit_assign(Mwd.visible_rows, last, FALSE);
+	g_array_remove_index_fast(Mwd.connections, row);
+}
+
+gboolean update_resolved_hosts_on_idle(gpointer data);
+
+static void host_resolved (const char *ip, const char *host, int status, gpointer user_data)
+{
+	if (Mwd.exit_requested)
+		return;
 	
-	g_assert(g_hash_table_lookup(Mwd.ip_host_hash, ip)==NULL);
-	g_hash_table_insert(Mwd.ip_host_hash, g_strdup(ip), host);
+	g_mutex_lock(Mwd.host_hash_lock);
+	/* the failed lookups are retried after the negative TTL, as the addresses without name */
+	host_cache_insert(Mwd.host_cache, ip, host);
 	g_hash_table_remove(Mwd.requested_ip_hash, ip); 
-	ip = NULL; /*it became invalid on the previous line*/
 	
-	g_mutex_unlock(Mwd.host_hash_lock);
+	/* the answers are applied in batches by one idle handler */
+	g_ptr_array_add(Mwd.resolved_addresses, g_strdup(ip));
+	Mwd.resolved_answers++;
+	if (Mwd.resolved_hosts_id == 0)
+		Mwd.resolved_hosts_id = g_idle_add(&update_resolved_hosts_on_idle, NULL);
 	
-	g_idle_add(&update_connections_hosts_on_idle, NULL);
+	g_mutex_unlock(Mwd.host_hash_lock);
 }
 
 static void init_host_loader ()
 {
-	Mwd.ip_host_hash = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &g_free);
+	Mwd.host_cache = host_cache_new((gsize)Mwd.host_cache_memory * 1024, 
+	                                Mwd.host_ttl, Mwd.host_negative_ttl);
+	if (Mwd.host_cache_persistent)
+	{
+		char *homedir = get_effective_home_dir();
+		if (homedir != NULL)
+		{
+			char *path = g_strdup_printf("%s/%s", homedir, HOST_CACHE_FILE_NAME);
+			DropToSudoData *dtosH = drop_to_sudo_user(); /*the file is owned by the user*/
+			host_cache_open_file(Mwd.host_cache, path);
+			restore_initial_user(dtosH);
+			g_free(path);
+			g_free(homedir);
+		}
+	}
 	Mwd.requested_ip_hash = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, NULL);
+	Mwd.pending_host_rows = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, 
+	                                              (GDestroyNotify)&g_hash_table_destroy);
+	Mwd.resolved_addresses = g_ptr_array_new();
 	Mwd.host_hash_lock = g_mutex_new();
 	
-	Mwd.host_loader_pool = g_thread_pool_new(&host_loader_thread_func, NULL, 5, TRUE, NULL);
+	Mwd.host_resolver = resolver_new(&Mwd.resolver_options, &host_resolved, NULL);
 }
 
 static void stop_host_loader ()
 {
-	g_thread_pool_free(Mwd.host_loader_pool, TRUE, TRUE);
-	Mwd.host_loader_pool = NULL;
+	if (Mwd.host_priority_id != 0)
+		g_source_remove(Mwd.host_priority_id);
+	Mwd.host_priority_id = 0;
+	resolver_free(Mwd.host_resolver);
+	Mwd.host_resolver = NULL;
+	if (Mwd.resolved_hosts_id != 0)
+		g_source_remove(Mwd.resolved_hosts_id);
+	Mwd.resolved_hosts_id = 0;
 }
 
 static void free_host_loader ()
 {	
-	g_hash_table_destroy(Mwd.ip_host_hash); Mwd.ip_host_hash = NULL;
+	HostCacheStats stats;
+	host_cache_get_stats(Mwd.host_cache, &stats);
+	nactv_trace("host cache: %u entries, %lu bytes, %llu hits (%llu from file), %llu misses, "
+	            "%llu expired, %llu evicted\n", 
+	            stats.entries, (unsigned long)stats.memory, (unsigned long long)stats.hits, 
+	            (unsigned long long)stats.file_hits, (unsigned long long)stats.misses, 
+	            (unsigned long long)stats.expirations, (unsigned long long)stats.evictions);
+	
+	host_cache_free(Mwd.host_cache); Mwd.host_cache = NULL;
 	g_hash_table_destroy(Mwd.requested_ip_hash); Mwd.requested_ip_hash = NULL;
+	g_hash_table_destroy(Mwd.pending_host_rows); Mwd.pending_host_rows = NULL;
+	g_ptr_array_foreach(Mwd.resolved_addresses, (GFunc)&g_free, NULL);
+	g_ptr_array_free(Mwd.resolved_addresses, TRUE); Mwd.resolved_addresses = NULL;
 	g_mutex_free(Mwd.host_hash_lock); Mwd.host_hash_lock = NULL;
 }
 
 #define MAX_HOST_REQUEST_QUEUE_LEN 100100
 
-static char *get_host (const char *ip)
+/* Called with host_hash_lock held */
+static char *lookup_host (const char *ip, int priority)
 {
+	const char *cached_host;
 	char *host_name = NULL;
+	
+	if (host_cache_lookup(Mwd.host_cache, ip, &cached_host))
+	{
+		host_name = g_strdup((cached_host != NULL) ? cached_host : "."); /*convention string for no host found*/
+	}else if (g_hash_table_lookup(Mwd.requested_ip_hash, ip) == NULL && 
+	          g_hash_table_size(Mwd.requested_ip_hash) < MAX_HOST_REQUEST_QUEUE_LEN)
+	{
+		char *hash_ip = g_strdup(ip);
+		g_hash_table_insert(Mwd.requested_ip_hash, hash_ip, (gpointer)1);
+		resolver_request(Mwd.host_resolver, hash_ip, priority);
+	}
+	return host_name;
+}
+
+static char *get_host (const char *ip, int priority)
+{
+	char *host_name;
 	if (Mwd.exit_requested)
 		return NULL;
 	
 	g_mutex_lock(Mwd.host_hash_lock);
+	host_name = lookup_host(ip, priority);
+	g_mutex_unlock(Mwd.host_hash_lock);
 	
-	host_name = (char*)g_hash_table_lookup(Mwd.ip_host_hash, ip);
-	if (host_name == NULL && g_hash_table_lookup(Mwd.requested_ip_hash, ip) == NULL && 
-	    g_hash_table_size(Mwd.requested_ip_hash) < MAX_HOST_REQUEST_QUEUE_LEN)
+	return host_name;
+}
+
+/* The hosts stage of the loader thread: the new connections get their cached hosts before 
+ * they are passed to the view, under one lock for the whole table. The missing hosts are 
+ * requested and marked pending. Returns the resolver answers count at the lookup. */
+static guint64 stamp_connections_hosts (NetConnection *connections, unsigned int nconnections, 
+                                        gboolean local_hosts, gboolean remote_hosts)
+{
+	unsigned int i;
+	guint64 answers;
+	
+	g_mutex_lock(Mwd.host_hash_lock);
+	for (i=0; i<nconnections && (local_hosts || remote_hosts) && !Mwd.exit_requested; i++)
 	{
-		char *hash_ip = g_strdup(ip);
-		g_hash_table_insert(Mwd.requested_ip_hash, hash_ip, (gpointer)1);
-		g_thread_pool_push(Mwd.host_loader_pool, hash_ip, NULL);
+		NetConnection *conn = &connections[i];
+		if (local_hosts && conn->localaddress != NULL)
+		{
+			conn->localhost = lookup_host(conn->localaddress, RESOLVER_PRIORITY_NORMAL);
+			if (conn->localhost == NULL)
+				conn->hosts_pending |= NC_HOST_LOCAL;
+		}
+		if (remote_hosts && conn->remoteaddress != NULL)
+		{
+			conn->remotehost = lookup_host(conn->remoteaddress, RESOLVER_PRIORITY_NORMAL);
+			if (conn->remotehost == NULL)
+				conn->hosts_pending |= NC_HOST_REMOTE;
+		}
 	}
-		
+	answers = Mwd.resolved_answers;
 	g_mutex_unlock(Mwd.host_hash_lock);
 	
-	return (host_name != NULL) ? g_strdup(host_name) : NULL;
+	return answers;
+}
+
+/* The rows being appended have no iter yet and their visibility is not known; they are 
+ * requested before the hidden rows, until the next update of the priorities */
+static int get_host_request_priority (NetConnection *conn)
+{
+	ListLineUserData *llud = (ListLineUserData*)conn->user_data;
+	return (llud->iter == NULL || row_visible(llud->row)) ? 
+		RESOLVER_PRIORITY_NORMAL : RESOLVER_PRIORITY_LOW;
 }
 
+static void add_pending_host_row (const char *address, NetConnection *conn)
+{
+	GHashTable *rows = (GHashTable*)g_hash_table_lookup(Mwd.pending_host_rows, address);
+	if (rows == NULL)
+	{
+		rows = g_hash_table_new(&g_direct_hash, &g_direct_equal);
+		g_hash_table_insert(Mwd.pending_host_rows, g_strdup(address), rows);
+	}
+	g_hash_table_insert(rows, conn, conn);
+}
+
+static void remove_pending_host_row (const char *address, NetConnection *conn)
+{
+	GHashTable *rows = (address != NULL) ? 
+		(GHashTable*)g_hash_table_lookup(Mwd.pending_host_rows, address) : NULL;
+	if (rows != NULL && g_hash_table_remove(rows, conn) && g_hash_table_size(rows) == 0)
+		g_hash_table_remove(Mwd.pending_host_rows, address);
+}
+
+/* The rows whose host is not known yet wait in pending_host_rows for the resolver answer. 
+ * The hosts marked pending by the loader are already requested. */
 static gboolean update_net_connection_hosts (NetConnection *conn)
 {
 	gboolean updated = FALSE;
+	int pending = Mwd.stamped_hosts_valid ? conn->hosts_pending : 0;
+	
+	conn->hosts_pending = 0;
 	if (Mwd.view_local_host && conn->localhost == NULL && conn->localaddress != NULL)
 	{
-		conn->localhost = get_host(conn->localaddress);
+		if (!(pending & NC_HOST_LOCAL))
+			conn->localhost = get_host(conn->localaddress, get_host_request_priority(conn));
 		updated = (updated || (conn->localhost != NULL));
+		if (conn->localhost == NULL)
+			add_pending_host_row(conn->localaddress, conn);
 	}
 	if (Mwd.view_remote_host && conn->remotehost == NULL && conn->remoteaddress != NULL)
 	{
-		conn->remotehost = get_host(conn->remoteaddress);
+		if (!(pending & NC_HOST_REMOTE))
+			conn->remotehost = get_host(conn->remoteaddress, get_host_request_priority(conn));
 		updated = (updated || (conn->remotehost != NULL));
+		if (conn->remotehost == NULL)
+			add_pending_host_row(conn->remoteaddress, conn);
 	}
 	return updated;
 }
 
-static void get_connection_port_names (NetConnection *conn, char **slocalport, 
-									  char **sremoteport)
+static void get_connection_port_names (NetConnection *conn, const char **slocalport, 
+									  const char **sremoteport)
 {
 	if (!Mwd.view_port_names)
 	{
@@ -398,7 +714,7 @@ static void update_ports_text ()
 	{
 		NetConnection *conn = g_array_index(Mwd.connections, NetConnection*, i);
 		ListLineUserData *llud = (ListLineUserData*)conn->user_data;
-		char *slocalport, *sremoteport;
+		const char *slocalport, *sremoteport;
 		
 		get_connection_port_names(conn, &slocalport, &sremoteport);
 		
@@ -406,16 +722,55 @@ static void update_ports_text ()
 						   MVC_LOCALPORT, slocalport,
 						   MVC_REMOTEPORT, sremoteport,
 						   -1);
-		g_free(slocalport);
-		g_free(sremoteport);
+		list_line_invalidate_filter_text(llud);
 	}
 }
 
-static void list_append_connection (NetConnection *conn)
+/* The subnets file has a prefix per line, optionally followed by the rows background: 
+ * 10.64.0.0/10 #ffd8d8 */
+static void load_subnet_colors ()
 {
-	char *slocalport, *sremoteport, spid[48]="";
+	char *homedir = get_effective_home_dir();
+	if (homedir != NULL)
+	{
+		char *path = g_strdup_printf("%s/%s", homedir, SUBNETS_FILE_NAME);
+		if (g_file_test(path, G_FILE_TEST_EXISTS))
+		{
+			Mwd.subnet_colors = prefix_trie_new();
+			if (!prefix_trie_add_file(Mwd.subnet_colors, path, DEFAULT_SUBNET_COLOR) || 
+			    prefix_trie_size(Mwd.subnet_colors) == 0)
+			{
+				prefix_trie_unref(Mwd.subnet_colors);
+				Mwd.subnet_colors = NULL;
+			}
+		}
+		g_free(path);
+		g_free(homedir);
+	}
+}
+
+/* The background of the rows not new or closed: the color of the remote address subnet, 
+ * else of the local address subnet */
+static const char *get_connection_subnet_color (NetConnection *conn)
+{
+	const char *color = NULL;
+	if (Mwd.view_colors && Mwd.subnet_colors != NULL)
+	{
+		color = (const char*)prefix_trie_lookup(Mwd.subnet_colors, &conn->remoteaddr);
+		if (color == NULL)
+			color = (const char*)prefix_trie_lookup(Mwd.subnet_colors, &conn->localaddr);
+	}
+	return color;
+}
+
+static void list_append_connection (NetConnection *conn, unsigned int row)
+{
+	const char *slocalport, *sremoteport;
+	char spid[48]="";
 	GtkTreeIter iter;
 	
+	/* hidden by the filtered model until its visibility is set */
+	conn->user_data = list_line_user_data_new(row);
 	update_net_connection_hosts(conn);
 	
 	get_connection_port_names(conn, &slocalport, &sremoteport);
@@ -434,18 +789,12 @@ static void list_append_connection (NetConnection *conn)
 		MVC_PID, spid,
 		MVC_PROGRAMNAME, VALUE_OR_DEF(conn->programname, ""), 
 		MVC_PROGRAMCOMMAND, VALUE_OR_DEF(conn->programcommand, ""),
-		MVC_VISIBLE, TRUE,
 		MVC_DATA, conn,
-		MVC_COLOR, (Mwd.view_colors && !Mwd.first_refresh) ? DEFAULT_NEW_COLOR : NULL,
+		MVC_COLOR, (Mwd.view_colors && !Mwd.first_refresh && !Mwd.needs_changed_refresh) ? 
+		           DEFAULT_NEW_COLOR : get_connection_subnet_color(conn),
 		-1);
-	conn->user_data = list_line_user_data_new(&iter);
-	
-	gtk_list_store_set(Mwd.main_store, ((ListLineUserData*)conn->user_data)->iter, 
-				       MVC_VISIBLE, connection_visible(conn),
-				       -1);
-	
-	g_free(slocalport);
-	g_free(sremoteport);
+	((ListLineUserData*)conn->user_data)->iter = gtk_tree_iter_copy(&iter);
+	update_row_visibility(conn);
 }
 
 static void list_remove_connection (NetConnection *conn)
@@ -471,8 +820,8 @@ static void list_set_closed_connection (NetConnection *conn)
 						   MVC_STATE, net_connection_get_state_name(conn),
 						   MVC_COLOR, Mwd.view_colors ? DEFAULT_CLOSED_COLOR : NULL,
 						   -1);
-		gtk_list_store_set(Mwd.main_store, llud->iter, 
-		                   MVC_VISIBLE, connection_visible(conn), -1);
+		list_line_invalidate_filter_text(llud);
+		update_row_visibility(conn);
 	}
 }
 
@@ -494,8 +843,8 @@ static void list_update_connection (NetConnection *conn)
 					   MVC_PROGRAMNAME, VALUE_OR_DEF(conn->programname, ""), 
 					   MVC_PROGRAMCOMMAND, VALUE_OR_DEF(conn->programcommand, ""),
 					   -1);
-	gtk_list_store_set(Mwd.main_store, llud->iter, 
-	                   MVC_VISIBLE, connection_visible(conn), -1);
+	list_line_invalidate_filter_text(llud);
+	update_row_visibility(conn);
 }
 
 static void list_free_net_connection (NetConnection *conn)
@@ -504,6 +853,11 @@ static void list_free_net_connection (NetConnection *conn)
 	{
 		ListLineUserData *llud = (ListLineUserData*)conn->user_data;
 		g_assert(llud!=NULL);
+		if (Mwd.pending_host_rows != NULL)
+		{
+			remove_pending_host_row(conn->localaddress, conn);
+			remove_pending_host_row(conn->remoteaddress, conn);
+		}
 		list_line_user_data_delete(llud);
 		net_connection_delete(conn);
 	}
@@ -519,7 +873,7 @@ static void delete_closed_connections ()
 		{
 			list_remove_connection(conn);
 			list_free_net_connection(conn);
-			g_array_remove_index_fast(Mwd.connections, i);
+			remove_connection_row(i);
 		}
 	}
 }
@@ -539,7 +893,7 @@ static void update_closed_connections ()
 			{
 				list_remove_connection(conn);
 				list_free_net_connection(conn);
-				g_array_remove_index_fast(Mwd.connections, i);
+				remove_connection_row(i);
 			}
 		}
 	}
@@ -560,12 +914,26 @@ static void update_colors ()
 				(g_timer_elapsed(llud->addedtime, NULL) > DEFAULT_NEW_SHOW_INT))
 			{
 				llud->state = LLS_NORMAL;
-				gtk_list_store_set(Mwd.main_store, llud->iter, MVC_COLOR, NULL, -1);
+				gtk_list_store_set(Mwd.main_store, llud->iter, MVC_COLOR, 
+				                   get_connection_subnet_color(conn), -1);
 			}
 		}
 	}
 }
 
+static void set_subnet_colors ()
+{
+	int i;
+	for (i=0; i<Mwd.connections->len; i++)
+	{
+		NetConnection* conn = g_array_index(Mwd.connections, NetConnection*, i);
+		ListLineUserData *llud = (ListLineUserData*)conn->user_data;
+		if (llud->state == LLS_NORMAL)
+			gtk_list_store_set(Mwd.main_store, llud->iter, MVC_COLOR, 
+			                   get_connection_subnet_color(conn), -1);
+	}
+}
+
 static void clear_colors ()
 {
 	int i;
@@ -584,7 +952,7 @@ static void refresh_net_statistics ()
 {
 	double telapsed = 0.;
 	if (Mwd.statistics_timer == NULL || 
-		(telapsed = g_timer_elapsed(Mwd.statistics_timer, NULL)) >= 1.)
+		(telapsed = g_timer_elapsed(Mwd.statistics_timer, NULL)) > 0.1)
 	{
 		unsigned long long bytes_received, bytes_sent, dbytes_received = 0, dbytes_sent = 0;
 		char *bytes_text, *dbytes_text, *status_text;
@@ -658,32 +1026,110 @@ static void refresh_established_conn (unsigned int nconn, unsigned int nestablis
 
 static void refresh_visible_conn_label ()
 {	
-	int nrvisible = gtk_tree_model_iter_n_children(Mwd.main_store_filtered, NULL);
-	char *text = g_strdup_printf(_("Visible: %u"), nrvisible);
+	char *text = g_strdup_printf(_("Visible: %u"), Mwd.nvisible_rows);
 	gtk_label_set_text(Mwd.label_visible, text);
 	g_free(text);
 }
 
 static gboolean refresh_main_view_on_idle (gpointer data);
+static gboolean refresh_unchanged_view_on_idle (gpointer data);
+
+/* A refresh going through the loader stages */
+typedef struct
+{
+	NetCollectorBatch *batch;
+	unsigned int needs_generation;
+	gboolean local_hosts, remote_hosts;
+} LoadJob;
+
+/* The jobs waiting between two stages; a stage is at most one refresh ahead of the next one */
+#define LOAD_QUEUE_CAPACITY 1
+
+static void load_job_free (LoadJob *job)
+{
+	net_collector_batch_free(job->batch);
+	g_free(job);
+}
 
 static gpointer connections_load_thread_func (gpointer data)
 {
+	unsigned int needs_generation = 0;
+	gboolean local_hosts = FALSE, remote_hosts = FALSE;
+	
 	while (!Mwd.exit_requested)
 	{
-		NetConnection *new_connections = NULL;
-		int nr_new_connections = 0;
+		LoadJob *job;
+		gboolean force;
 		
 		g_mutex_lock(Mwd.refresh_request_lock);
 		while (!Mwd.refresh_requested && !Mwd.exit_requested)
 			g_cond_wait(Mwd.refresh_request_cond, Mwd.refresh_request_lock);
 		Mwd.refresh_requested = FALSE;
+		force = Mwd.refresh_forced;
+		Mwd.refresh_forced = FALSE;
+		if (Mwd.collector_needs_changed)
+		{
+			local_hosts = Mwd.collector_needs->local_hosts;
+			remote_hosts = Mwd.collector_needs->remote_hosts;
+			net_collector_set_needs(Mwd.collector, Mwd.collector_needs);
+			needs_generation = Mwd.needs_generation;
+			Mwd.collector_needs = NULL;
+			Mwd.collector_needs_changed = FALSE;
+		}
 		g_mutex_unlock(Mwd.refresh_request_lock);
 		
 		if (Mwd.exit_requested)
 			break;
 		
-		new_connections = NULL;
-		nr_new_connections = get_net_connections(&new_connections);
+		job = g_new0(LoadJob, 1);
+		job->batch = net_collector_load_sockets(Mwd.collector, force);
+		job->needs_generation = needs_generation;
+		job->local_hosts = local_hosts;
+		job->remote_hosts = remote_hosts;
+		if (!bounded_queue_push(Mwd.attribution_queue, job))
+			load_job_free(job);
+	}
+	return NULL;
+}
+
+static gpointer connections_attribution_thread_func (gpointer data)
+{
+	LoadJob *job;
+	while ((job = (LoadJob*)bounded_queue_pop(Mwd.attribution_queue)) != NULL)
+	{
+		if (!Mwd.exit_requested)
+			net_collector_batch_attribute(Mwd.collector, job->batch);
+		if (Mwd.exit_requested || !bounded_queue_push(Mwd.publish_queue, job))
+			load_job_free(job);
+	}
+	return NULL;
+}
+
+static gpointer connections_publish_thread_func (gpointer data)
+{
+	LoadJob *job;
+	while ((job = (LoadJob*)bounded_queue_pop(Mwd.publish_queue)) != NULL)
+	{
+		NetConnection *new_connections;
+		unsigned int nr_new_connections;
+		guint64 stamped_answers;
+		
+		if (Mwd.exit_requested)
+		{
+			load_job_free(job);
+			continue;
+		}
+		if (!net_collector_batch_changed(job->batch))
+		{
+			load_job_free(job);
+			g_idle_add(&refresh_unchanged_view_on_idle, NULL);
+			continue;
+		}
+		
+		net_collector_batch_load_processes(Mwd.collector, job->batch);
+		new_connections = net_collector_batch_take_connections(job->batch, &nr_new_connections);
+		stamped_answers = stamp_connections_hosts(new_connections, nr_new_connections, 
+		                                          job->local_hosts, job->remote_hosts);
 		
 		g_mutex_lock(Mwd.loaded_conn_lock);
 		
@@ -691,9 +1137,13 @@ static gpointer connections_load_thread_func (gpointer data)
 			free_net_connections(Mwd.latest_connections, Mwd.nr_latest_connections);
 		Mwd.latest_connections = new_connections;
 		Mwd.nr_latest_connections = nr_new_connections;
+		Mwd.loaded_needs_generation = job->needs_generation;
+		Mwd.latest_stamped_answers = stamped_answers;
+		Mwd.published_loads++;
 		
 		g_mutex_unlock(Mwd.loaded_conn_lock);
-	
+		
+		load_job_free(job);
 		g_idle_add(&refresh_main_view_on_idle, NULL);
 	}
 	return NULL;
@@ -704,7 +1154,15 @@ static void init_connections_loader ()
 	Mwd.refresh_request_lock = g_mutex_new();
 	Mwd.loaded_conn_lock = g_mutex_new();
 	Mwd.refresh_request_cond = g_cond_new();
-	
+	Mwd.collector = net_collector_new();
+	net_collector_set_periods(Mwd.collector, Mwd.attribution_period, Mwd.processes_period);
+	Mwd.attribution_queue = bounded_queue_new(LOAD_QUEUE_CAPACITY);
+	Mwd.publish_queue = bounded_queue_new(LOAD_QUEUE_CAPACITY);
+	
+	Mwd.publish_thread = g_thread_create(&connections_publish_thread_func, NULL, TRUE, NULL);
+	g_assert(Mwd.publish_thread != NULL);
+	Mwd.attribution_thread = g_thread_create(&connections_attribution_thread_func, NULL, TRUE, NULL);
+	g_assert(Mwd.attribution_thread != NULL);
 	Mwd.data_load_thread = g_thread_create(&connections_load_thread_func, NULL,
 										   TRUE, NULL);
 	g_assert(Mwd.data_load_thread != NULL);
@@ -713,9 +1171,17 @@ static void init_connections_loader ()
 static void stop_connections_loader ()
 {
 	Mwd.exit_requested = TRUE;
+	g_mutex_lock(Mwd.refresh_request_lock);
 	g_cond_signal(Mwd.refresh_request_cond);
+	g_mutex_unlock(Mwd.refresh_request_lock);
+	bounded_queue_close(Mwd.attribution_queue);
+	bounded_queue_close(Mwd.publish_queue);
 	g_thread_join(Mwd.data_load_thread);
 	Mwd.data_load_thread = NULL;
+	g_thread_join(Mwd.attribution_thread);
+	Mwd.attribution_thread = NULL;
+	g_thread_join(Mwd.publish_thread);
+	Mwd.publish_thread = NULL;
 }
 
 static void free_connections_loader ()
@@ -723,6 +1189,16 @@ static void free_connections_loader ()
 	g_mutex_free(Mwd.refresh_request_lock);
 	g_mutex_free(Mwd.loaded_conn_lock);
 	g_cond_free(Mwd.refresh_request_cond);
+	bounded_queue_free(Mwd.attribution_queue, (GDestroyNotify)&load_job_free);
+	Mwd.attribution_queue = NULL;
+	bounded_queue_free(Mwd.publish_queue, (GDestroyNotify)&load_job_free);
+	Mwd.publish_queue = NULL;
+	net_collector_free(Mwd.collector);
+	Mwd.collector = NULL;
+	net_collector_needs_free(Mwd.collector_needs);
+	Mwd.collector_needs = NULL;
+	net_collector_needs_free(Mwd.view_needs);
+	Mwd.view_needs = NULL;
 	
 	if (Mwd.latest_connections != NULL)
 	{
@@ -732,9 +1208,81 @@ static void free_connections_loader ()
 }
 
 
+#define HOST_PRIORITY_UPDATE_DELAY 100 /*ms*/
+
+static void add_missing_hosts_addresses (NetConnection *conn, GPtrArray *addresses)
+{
+	if (Mwd.view_local_host && conn->localhost == NULL && conn->localaddress != NULL)
+		g_ptr_array_add(addresses, conn->localaddress);
+	if (Mwd.view_remote_host && conn->remotehost == NULL && conn->remoteaddress != NULL)
+		g_ptr_array_add(addresses, conn->remoteaddress);
+}
+
+/* The hosts of the rows in the viewport are requested first, then the ones of the rows 
+ * shown by the filter and the state options, then the others */
+static gboolean update_host_requests_priorities (gpointer data)
+{
+	GPtrArray *viewport_addresses = g_ptr_array_new(), *shown_addresses = g_ptr_array_new();
+	GtkTreePath *start_path, *end_path;
+	unsigned int w, nwords = (Mwd.connections->len + ROWS_WORD_BITS - 1) / ROWS_WORD_BITS;
+	
+	Mwd.host_priority_id = 0;
+	if (Mwd.exit_requested || !(Mwd.view_local_host || Mwd.view_remote_host))
+		return FALSE;
+	
+	for (w=0; w<nwords; w++)
+	{
+		gulong visible = Mwd.visible_rows[w];
+		while (visible != 0)
+		{
+			unsigned int row = w * ROWS_WORD_BITS + g_bit_nth_lsf(visible, -1);
+			add_missing_hosts_addresses(g_array_index(Mwd.connections, NetConnection*, row), 
+			                            shown_addresses);
+			visible &= visible - 1;
+		}
+	}
+	
+	if (gtk_tree_view_get_visible_range(Mwd.main_view, &start_path, &end_path))
+	{
+		GtkTreeIter iter;
+		int nrows = gtk_tree_path_get_indices(end_path)[0] - gtk_tree_path_get_indices(start_path)[0] + 1;
+		gboolean valid = gtk_tree_model_get_iter(Mwd.main_store_filtered, &iter, start_path);
+		
+		for (; valid && nrows > 0; nrows--)
+		{
+			NetConnection *conn = NULL;
+			gtk_tree_model_get(Mwd.main_store_filtered, &iter, MVC_DATA, &conn, -1);
+			add_missing_hosts_addresses(conn, viewport_addresses);
+			valid = gtk_tree_model_iter_next(Mwd.main_store_filtered, &iter);
+		}
+		gtk_tree_path_free(start_path);
+		gtk_tree_path_free(end_path);
+	}
+	
+	resolver_set_priorities(Mwd.host_resolver, viewport_addresses, shown_addresses);
+	g_ptr_array_free(viewport_addresses, TRUE);
+	g_ptr_array_free(shown_addresses, TRUE);
+	return FALSE;
+}
+
+/* Called when the rows in the viewport or the shown rows may have changed */
+static void schedule_host_requests_priorities ()
+{
+	if (Mwd.host_priority_id == 0 && Mwd.host_resolver != NULL)
+		Mwd.host_priority_id = g_timeout_add(HOST_PRIORITY_UPDATE_DELAY, 
+		                                     &update_host_requests_priorities, NULL);
+}
+
+static void on_main_view_scrolled (GtkAdjustment *adjustment, gpointer user_data)
+{
+	schedule_host_requests_priorities();
+}
+
+
 static void refresh_main_view (void)
 {
-	unsigned int i, nvalid_conn = 0, nestablished_conn = 0;
+	unsigned int i, nvalid_conn = 0, nestablished_conn = 0, nchanges = 0;
+	gboolean needs_changed;
 	
 	if (Mwd.view_colors)
 		update_colors();
@@ -745,9 +1293,17 @@ static void refresh_main_view (void)
 	
 	net_connection_update_list_full(Mwd.connections, Mwd.latest_connections, 
 									Mwd.nr_latest_connections);
+	rows_bits_reserve(Mwd.connections->len);
+	/* The connections added or removed by a change of the collected sockets are not new or closed */
+	needs_changed = (Mwd.loaded_needs_generation != Mwd.shown_needs_generation);
+	Mwd.shown_needs_generation = Mwd.loaded_needs_generation;
+	Mwd.shown_loads = Mwd.published_loads;
+	Mwd.stamped_hosts_valid = (Mwd.drained_answers <= Mwd.latest_stamped_answers);
 	
 	g_mutex_unlock(Mwd.loaded_conn_lock);
 	
+	Mwd.needs_changed_refresh = needs_changed;
+	
 	for(i=0; i<Mwd.connections->len; i++)
 	{
 		NetConnection* conn = g_array_index(Mwd.connections, NetConnection*, i);
@@ -755,7 +1311,7 @@ static void refresh_main_view (void)
 		switch(conn->operation)
 		{
 		case NC_OP_INSERT:
-			list_append_connection(conn);
+			list_append_connection(conn, i);
 			break;
 		case NC_OP_UPDATE:
 			list_update_connection(conn);
@@ -764,6 +1320,8 @@ static void refresh_main_view (void)
 			list_set_closed_connection(conn);
 			break;
 		}
+		if (conn->operation != NC_OP_NONE)
+			nchanges++;
 		
 		if (conn->operation != NC_OP_DELETE)
 		{
@@ -772,17 +1330,50 @@ static void refresh_main_view (void)
 				nestablished_conn++;
 		}
 	}
-	if (!Mwd.show_closed_connections)
+	Mwd.stamped_hosts_valid = FALSE;
+	Mwd.changed_refreshes++;
+	Mwd.refresh_changes += nchanges;
+	if (!Mwd.show_closed_connections || needs_changed)
 		delete_closed_connections();
+	Mwd.needs_changed_refresh = FALSE;
 	
 	refresh_established_conn(nvalid_conn, nestablished_conn);
 	refresh_visible_conn_label();
-	refresh_net_statistics();
+	if (Mwd.statistics_refresh_id == 0 || Mwd.first_refresh)
+		refresh_net_statistics();
+	schedule_host_requests_priorities();
 	Mwd.first_refresh = FALSE;
 	Mwd.manual_refresh = FALSE;
 }
 
 
+/* The loaded connections did not change. Only the time dependent parts of the view 
+ * are updated: new and closed connections expiration and the statistics. */
+static void refresh_unchanged_view (void)
+{
+	Mwd.skipped_refreshes++;
+	Mwd.unchanged_refreshes++;
+	nactv_trace("Unchanged connections; skipped refreshes: %u\n", Mwd.skipped_refreshes);
+	
+	if (Mwd.view_colors)
+		update_colors();
+	if (Mwd.show_closed_connections)
+		update_closed_connections();
+	
+	refresh_visible_conn_label();
+	if (Mwd.statistics_refresh_id == 0)
+		refresh_net_statistics();
+}
+
+static gboolean has_unshown_load (void)
+{
+	gboolean unshown;
+	g_mutex_lock(Mwd.loaded_conn_lock);
+	unshown = (Mwd.shown_loads != Mwd.published_loads);
+	g_mutex_unlock(Mwd.loaded_conn_lock);
+	return unshown;
+}
+
 static gboolean refresh_main_view_on_idle (gpointer data)
 {
 	if (Mwd.exit_requested)
@@ -795,19 +1386,41 @@ static gboolean refresh_main_view_on_idle (gpointer data)
 	return FALSE;
 }
 
+static gboolean refresh_unchanged_view_on_idle (gpointer data)
+{
+	if (Mwd.exit_requested)
+		return FALSE;
+	if (Mwd.update_disabled)
+		return FALSE;
+	
+	/* An unchanged load compares with the latest one, which may not be shown yet */
+	if (has_unshown_load())
+		refresh_main_view();
+	else
+		refresh_unchanged_view();
+	
+	return FALSE;
+}
+
 
-static void refresh_connections ()
+static void request_connections_refresh (gboolean force)
 {
 	g_mutex_lock(Mwd.refresh_request_lock);
 	Mwd.refresh_requested = TRUE;
+	Mwd.refresh_forced = (Mwd.refresh_forced || force);
 	g_cond_signal(Mwd.refresh_request_cond);
 	g_mutex_unlock(Mwd.refresh_request_lock);
 }
 
+static void refresh_connections ()
+{
+	request_connections_refresh(FALSE);
+}
+
 static void manual_refresh_connections ()
 {
 	Mwd.manual_refresh = TRUE;
-	refresh_connections();
+	request_connections_refresh(TRUE);
 }
 
 
@@ -855,6 +1468,19 @@ static GArray *get_visible_columns_indexes (void)
 	return visible_col_idx;
 }
 
+static void invalidate_filter_columns ()
+{
+	if (Mwd.filter_columns != NULL)
+		g_array_free(Mwd.filter_columns, TRUE);
+	Mwd.filter_columns = NULL;
+	Mwd.filter_text_generation++;
+}
+
+static void on_main_view_columns_changed (GtkTreeView *tree_view, gpointer user_data)
+{
+	invalidate_filter_columns();
+}
+
 static char* get_store_value (GtkTreeIter *iter, int columnindex)
 {
 	GValue value = {0, };
@@ -875,17 +1501,19 @@ static void append_get_store_value (GtkTreeIter *iter, int columnindex,
 	g_value_unset (&value);
 }
 
+#define FILTER_COLUMN_SEPARATOR "   "
+
 static GString *get_line_column_text_4filter (GtkTreeIter *iter, const int *columnindexes, int nindexes)
 {
 	int i;
 	GString *text;
 	
-	text = g_string_new("   ");
+	text = g_string_new(FILTER_COLUMN_SEPARATOR);
 	
 	for (i=0; i<nindexes; i++)
 	{
 		append_get_store_value(iter, columnindexes[i], text, "%s");
-		g_string_append(text, "   ");
+		g_string_append(text, FILTER_COLUMN_SEPARATOR);
 	}
 	
 	return text;
@@ -1033,39 +1661,53 @@ static void copy_selected_lines ()
 }
 
 
+/* Returns the row text compared with the filter, made once for the row content */
+static const char *get_connection_filter_text (ListLineUserData *llud)
+{
+	if (llud->filter_text == NULL || llud->filter_text_generation != Mwd.filter_text_generation)
+	{
+		GString *text;
+		
+		if (Mwd.filter_columns == NULL)
+			Mwd.filter_columns = get_visible_columns_indexes();
+		text = get_line_column_text_4filter(llud->iter, (int*)Mwd.filter_columns->data, 
+		                                    Mwd.filter_columns->len);
+		g_free(llud->filter_text);
+		if (Mwd.filter_text_casefolded && !string_is_ascii(text->str, text->len))
+		{
+			llud->filter_text = g_utf8_casefold(text->str, -1);
+			g_string_free(text, TRUE);
+		}else
+			llud->filter_text = g_string_free(text, FALSE);
+		llud->filter_text_generation = Mwd.filter_text_generation;
+	}
+	return llud->filter_text;
+}
+
 static gboolean connection_filtered (NetConnection *conn)
 {
 	g_assert(conn->user_data!=NULL);
 	if (Mwd.filtering && Mwd.filter->len > 0)
 	{
-		ListLineUserData *llud;
-		GArray *visible_col_idx;
-		GString* text;
-		gboolean filtered;
-		
-		llud = (ListLineUserData*)conn->user_data;
+		ListLineUserData *llud = (ListLineUserData*)conn->user_data;
 		
-		visible_col_idx = get_visible_columns_indexes();
-		text = get_line_column_text_4filter(llud->iter, (int*)visible_col_idx->data, visible_col_idx->len);
-
-		if (Mwd.caseSensitiveFilter)
-			filtered = IsFiltered(text->str, Mwd.filterTree, casSensitive);
-		else
+		if (Mwd.filterRegex)
 		{
-			gchar *entryNcText = g_utf8_casefold(text->str, -1);
-			filtered = IsFiltered(entryNcText, Mwd.filterTreeNoCase, casSensitive);
-			g_free(entryNcText);
+			/* matched from the first column */
+			return (Mwd.regexFilter == NULL || 
+			        g_regex_match(Mwd.regexFilter, get_connection_filter_text(llud) + 
+			                      strlen(FILTER_COLUMN_SEPARATOR), 0, NULL));
 		}
+		if (!FilterProgramUsesText(Mwd.filterProgram))
+			return RunFilterProgram(Mwd.filterProgram, "", conn);
 		
-		g_string_free(text, TRUE);
-		g_array_free(visible_col_idx, TRUE);
-		
-		return filtered;
+		return RunFilterProgram(Mwd.filterProgram, get_connection_filter_text(llud), conn);
 	}else
 		return TRUE;
 }
 
-static void update_connections_visibility ()
+/* If only_visible, the filter can only hide rows and the rows filtered out are not checked */
+static void update_connections_visibility_ex (gboolean only_visible)
 {
 	int i;
 	for (i=0; i<Mwd.connections->len; i++)
@@ -1075,11 +1717,229 @@ static void update_connections_visibility ()
 		g_assert(conn->user_data!=NULL);
 		llud = (ListLineUserData*)conn->user_data;
 		
-		gtk_list_store_set(Mwd.main_store, llud->iter, 
-						   MVC_VISIBLE, connection_visible(conn),
-						   -1);
+		if (only_visible && !row_bit(Mwd.filtered_rows, llud->row))
+			continue;
+		row_bit_assign(Mwd.filtered_rows, llud->row, connection_filtered(conn));
 	}
+	combine_rows_visibility();
 	refresh_visible_conn_label();
+	schedule_host_requests_priorities();
+}
+
+static void update_connections_visibility ()
+{
+	update_connections_visibility_ex(FALSE);
+}
+
+
+#define FILTER_THREAD_MIN_ROWS 5000
+#define FILTER_UPDATE_DELAY 150 /*ms after the last key press*/
+
+/* An evaluation of the filter over a snapshot of the rows, made on the filter thread. 
+ * Only the result of the last started evaluation is applied to the rows. */
+typedef struct _FilterJob
+{
+	unsigned int id;
+	volatile gboolean cancelled;
+	FilterProgram *program; /*own copies, the filter may change meanwhile*/
+	GRegex *regex;
+	int nrows;
+	NetConnection *conns; /*only the fields compared by the filter*/
+	char **texts; /*NULL if the filter does not use the rows text*/
+	guint32 *filtered; /*bitmap of the rows passing the filter*/
+} FilterJob;
+
+static void filter_job_free (FilterJob *job)
+{
+	int i;
+	for (i=0; i<job->nrows; i++)
+	{
+		g_free(job->conns[i].programname);
+		if (job->texts != NULL)
+			g_free(job->texts[i]);
+	}
+	g_free(job->conns);
+	g_free(job->texts);
+	g_free(job->filtered);
+	FreeFilterProgram(job->program);
+	if (job->regex != NULL)
+		g_regex_unref(job->regex);
+	g_free(job);
+}
+
+static gboolean apply_filter_job_on_idle (gpointer data)
+{
+	FilterJob *job = (FilterJob*)data;
+	int i;
+	
+	if (!Mwd.exit_requested && job == Mwd.filter_job && !job->cancelled)
+	{
+		for (i=0; i<Mwd.connections->len; i++)
+		{
+			NetConnection *conn = g_array_index(Mwd.connections, NetConnection*, i);
+			ListLineUserData *llud = (ListLineUserData*)conn->user_data;
+			if (llud->filter_job_id == job->id)
+			{
+				gboolean filtered = ((job->filtered[llud->filter_job_row / 32] >> (llud->filter_job_row % 32)) & 1);
+				llud->filter_job_id = 0;
+				row_bit_assign(Mwd.filtered_rows, llud->row, filtered);
+			}
+		}
+		combine_rows_visibility();
+		Mwd.filter_job = NULL;
+		refresh_visible_conn_label();
+		schedule_host_requests_priorities();
+	}
+	filter_job_free(job);
+	return FALSE;
+}
+
+static void filter_thread_func (gpointer data, gpointer user_data)
+{
+	FilterJob *job = (FilterJob*)data;
+	int i;
+	
+	for (i=0; i<job->nrows && !job->cancelled; i++)
+	{
+		gboolean filtered;
+		if (job->regex != NULL)
+			filtered = g_regex_match(job->regex, job->texts[i] + strlen(FILTER_COLUMN_SEPARATOR), 0, NULL);
+		else
+			filtered = RunFilterProgram(job->program, (job->texts != NULL) ? job->texts[i] : "", 
+			                            &job->conns[i]);
+		if (filtered)
+			job->filtered[i / 32] |= 1u << (i % 32);
+	}
+	/* A job cancelled before it ends is freed here, the others by their idle callback */
+	if (job->cancelled)
+		filter_job_free(job);
+	else
+		g_idle_add(&apply_filter_job_on_idle, job);
+}
+
+static void init_filter_thread ()
+{
+	Mwd.filter_pool = g_thread_pool_new(&filter_thread_func, NULL, 1, TRUE, NULL);
+}
+
+static void cancel_filter_job ()
+{
+	if (Mwd.filter_job != NULL)
+		Mwd.filter_job->cancelled = TRUE; /*freed by the filter thread or its idle callback*/
+	Mwd.filter_job = NULL;
+}
+
+static void stop_filter_thread ()
+{
+	if (Mwd.filter_update_id != 0)
+		g_source_remove(Mwd.filter_update_id);
+	Mwd.filter_update_id = 0;
+	cancel_filter_job();
+	/* the queued jobs, all cancelled, are run to be freed */
+	g_thread_pool_free(Mwd.filter_pool, FALSE, TRUE);
+	Mwd.filter_pool = NULL;
+}
+
+/* Updates the rows visibility after the filter changed. If only_visible, the filter can 
+ * only hide rows. Large tables are evaluated on the filter thread; the rows that change 
+ * meanwhile are evaluated by their update. */
+static void start_filter_evaluation (gboolean only_visible)
+{
+	FilterJob *job;
+	gboolean uses_text;
+	int i;
+	
+	cancel_filter_job();
+	if (Mwd.connections->len < FILTER_THREAD_MIN_ROWS || !(Mwd.filtering && Mwd.filter->len > 0) || 
+	    (Mwd.filterRegex && Mwd.regexFilter == NULL))
+	{
+		update_connections_visibility_ex(only_visible);
+		return;
+	}
+	
+	job = (FilterJob*)g_malloc0(sizeof(FilterJob));
+	job->id = ++Mwd.filter_job_id;
+	if (job->id == 0)
+		job->id = ++Mwd.filter_job_id; /*0 is for no evaluation*/
+	if (Mwd.filterRegex)
+		job->regex = g_regex_ref(Mwd.regexFilter);
+	else
+		job->program = CompileFilter(Mwd.caseSensitiveFilter ? Mwd.filterTree : Mwd.filterTreeNoCase, 
+		                             Mwd.caseSensitiveFilter ? casSensitive : casInsensitiveLibc);
+	uses_text = (Mwd.filterRegex || FilterProgramUsesText(job->program));
+	
+	job->conns = (NetConnection*)g_malloc(sizeof(NetConnection) * Mwd.connections->len);
+	if (uses_text)
+		job->texts = (char**)g_malloc(sizeof(char*) * Mwd.connections->len);
+	for (i=0; i<Mwd.connections->len; i++)
+	{
+		NetConnection *conn = g_array_index(Mwd.connections, NetConnection*, i), *copy;
+		ListLineUserData *llud = (ListLineUserData*)conn->user_data;
+		
+		if (only_visible && !row_bit(Mwd.filtered_rows, llud->row))
+			continue;
+		copy = &job->conns[job->nrows];
+		memcpy(copy, conn, sizeof(NetConnection));
+		copy->localhost = copy->localaddress = copy->remotehost = copy->remoteaddress = NULL;
+		copy->programcommand = NULL;
+		copy->programname = g_strdup(conn->programname);
+		copy->user_data = NULL;
+		if (uses_text)
+			job->texts[job->nrows] = g_strdup(get_connection_filter_text(llud));
+		llud->filter_job_id = job->id;
+		llud->filter_job_row = job->nrows;
+		job->nrows++;
+	}
+	job->filtered = (guint32*)g_malloc0(sizeof(guint32) * (job->nrows / 32 + 1));
+	
+	Mwd.filter_job = job;
+	g_thread_pool_push(Mwd.filter_pool, job, NULL);
+}
+
+/* Passes to the loader what the view and the filter can show. The sockets of the filter 
+ * are loaded by the kernel only. */
+static void update_collector_needs ()
+{
+	NetCollectorNeeds *needs = (NetCollectorNeeds*)g_malloc0(sizeof(NetCollectorNeeds));
+	NetSocketFilter *socket_filter = NULL;
+	
+	if (Mwd.filtering && Mwd.filter->len > 0)
+		socket_filter = GetFilterSocketFilter(Mwd.filterTree);
+	if (socket_filter != NULL)
+	{
+		needs->sockets = *socket_filter;
+		g_free(socket_filter);
+	}else
+	{
+		needs->sockets.states = NSF_ALL_STATES;
+		needs->sockets.protocols = NSF_ALL_PROTOCOLS;
+	}
+	if (!Mwd.view_unestablished_connections)
+		needs->sockets.states &= (1 << NC_TCP_ESTABLISHED);
+	needs->processes = (gtk_tree_view_column_get_visible(Mwd.main_view_columns[MVC_PID]) || 
+	                    gtk_tree_view_column_get_visible(Mwd.main_view_columns[MVC_PROGRAMNAME]) ||
+	                    gtk_tree_view_column_get_visible(Mwd.main_view_columns[MVC_PROGRAMCOMMAND]) ||
+	                    (Mwd.filtering && Mwd.filter->len > 0 && FilterUsesProcesses(Mwd.filterTree)));
+	needs->local_hosts = Mwd.view_local_host;
+	needs->remote_hosts = Mwd.view_remote_host;
+	
+	if (net_collector_needs_equals(needs, Mwd.view_needs))
+	{
+		net_collector_needs_free(needs);
+		return;
+	}
+	net_collector_needs_free(Mwd.view_needs);
+	Mwd.view_needs = needs;
+	
+	g_mutex_lock(Mwd.refresh_request_lock);
+	net_collector_needs_free(Mwd.collector_needs);
+	Mwd.collector_needs = (NetCollectorNeeds*)g_memdup(needs, sizeof(NetCollectorNeeds));
+	Mwd.collector_needs->sockets.condition = net_socket_condition_copy(needs->sockets.condition);
+	Mwd.collector_needs_changed = TRUE;
+	Mwd.needs_generation++;
+	g_mutex_unlock(Mwd.refresh_request_lock);
+	
+	request_connections_refresh(TRUE);
 }
 
 static void FreeFilterData ()
@@ -1093,20 +1953,103 @@ static void FreeFilterData ()
 	if (Mwd.filterTreeNoCase != NULL)
 		FreeFilter(Mwd.filterTreeNoCase);
 	Mwd.filterTreeNoCase = NULL;
+	FreeFilterProgram(Mwd.filterProgram);
+	Mwd.filterProgram = NULL;
+	if (Mwd.regexFilter != NULL)
+		g_regex_unref(Mwd.regexFilter);
+	Mwd.regexFilter = NULL;
+}
+
+/* Marks the filter entry when the regular expression can't be compiled */
+static void set_filter_error (gboolean error)
+{
+	GtkWidget *filter_entry = glade_xml_get_widget(GladeXml, "txtFilter");
+	if (error)
+	{
+		GdkColor error_color;
+		gdk_color_parse("#FFC8C8", &error_color);
+		gtk_widget_modify_base(filter_entry, GTK_STATE_NORMAL, &error_color);
+	}else
+		gtk_widget_modify_base(filter_entry, GTK_STATE_NORMAL, NULL);
+}
+
+static void compile_regex_filter (const char *filterText)
+{
+	GError *error = NULL;
+	GRegexCompileFlags flags = G_REGEX_OPTIMIZE;
+	
+	if (!Mwd.caseSensitiveFilter)
+		flags |= G_REGEX_CASELESS;
+	Mwd.regexFilter = g_regex_new(filterText, flags, 0, &error);
+	if (error != NULL)
+	{
+		nactv_trace("filter regex error: %s\n", error->message);
+		g_error_free(error);
+	}
 }
 
 static void update_filter ()
 {	
 	char *filterText = Mwd.filter->str;
+	/* Without operators the words are ANDed: a longer filter text can only hide rows. 
+	 * While an evaluation is in flight the rows still show an older filter. */
+	gboolean narrowing = (Mwd.applied_filter != NULL && Mwd.filter_job == NULL && 
+	                      !Mwd.filterOperators && !Mwd.filterRegex && 
+	                      !Mwd.applied_filter_operators && !Mwd.applied_filter_regex && 
+	                      Mwd.caseSensitiveFilter == Mwd.applied_filter_case_sensitive &&
+	                      g_str_has_prefix(filterText, Mwd.applied_filter));
+	
+	if (Mwd.filter_update_id != 0)
+	{
+		g_source_remove(Mwd.filter_update_id);
+		Mwd.filter_update_id = 0;
+	}
 	FreeFilterData();
-	if (Mwd.filterOperators)
+	if (Mwd.filterRegex)
+		compile_regex_filter(filterText);
+	else if (Mwd.filterOperators)
 		Mwd.filterTree = ParseFilter(filterText, &Mwd.filterMask);
 	else
 		Mwd.filterTree = ParseFilterNoOperators(filterText);
+	set_filter_error(Mwd.filterRegex && Mwd.regexFilter == NULL && Mwd.filter->len > 0);
 	if (!Mwd.caseSensitiveFilter)
 		Mwd.filterTreeNoCase = CaseFoldFilterUTF8(Mwd.filterTree);
+	Mwd.filterProgram = CompileFilter(Mwd.caseSensitiveFilter ? Mwd.filterTree : Mwd.filterTreeNoCase, 
+	                                  Mwd.caseSensitiveFilter ? casSensitive : casInsensitiveLibc);
+	/* A caseless regex matches the text as shown: folding can change the characters (ß to ss) */
+	if (Mwd.filter_text_casefolded != (!Mwd.caseSensitiveFilter && !Mwd.filterRegex))
+	{
+		Mwd.filter_text_casefolded = (!Mwd.caseSensitiveFilter && !Mwd.filterRegex);
+		Mwd.filter_text_generation++;
+	}
+
+	start_filter_evaluation(narrowing);
+	g_free(Mwd.applied_filter);
+	Mwd.applied_filter = g_strdup(filterText);
+	Mwd.applied_filter_operators = Mwd.filterOperators;
+	Mwd.applied_filter_regex = Mwd.filterRegex;
+	Mwd.applied_filter_case_sensitive = Mwd.caseSensitiveFilter;
+	update_collector_needs();
+}
+
+static gboolean update_filter_on_timeout (gpointer data)
+{
+	Mwd.filter_update_id = 0;
+	if (!Mwd.exit_requested)
+		update_filter();
+	return FALSE;
+}
 
-	update_connections_visibility();	
+/* Typing in a large table is applied once the typing pauses */
+static void schedule_filter_update ()
+{
+	if (Mwd.filter_update_id != 0)
+		g_source_remove(Mwd.filter_update_id);
+	Mwd.filter_update_id = 0;
+	if (Mwd.connections->len < FILTER_THREAD_MIN_ROWS)
+		update_filter();
+	else
+		Mwd.filter_update_id = g_timeout_add(FILTER_UPDATE_DELAY, update_filter_on_timeout, NULL);
 }
 
 static void clear_filter ()
@@ -1272,6 +2215,7 @@ static void load_preferences ()
 		get_boolean_preference(config_file, "Edit", "Filtering", &Mwd.filtering);
 		get_boolean_preference(config_file, "Edit", "CaseSensitiveFilter", &Mwd.caseSensitiveFilter);
 		get_boolean_preference(config_file, "Edit", "FilterOperators", &Mwd.filterOperators);
+		get_boolean_preference(config_file, "Edit", "FilterRegex", &Mwd.filterRegex);
 		svalue = g_key_file_get_string(config_file, "Edit", "Filter", NULL);
 		if (svalue != NULL)
 		{
@@ -1286,6 +2230,22 @@ static void load_preferences ()
 		if (intvalue == GTK_SORT_ASCENDING || intvalue == GTK_SORT_DESCENDING)
 			Mwd.current_sort_direction = intvalue;
 		
+		Mwd.resolver_options.nameservers = g_key_file_get_string_list(config_file, "Resolver", 
+		                                                               "Nameservers", NULL, NULL);
+		get_int_preference(config_file, "Resolver", "Concurrency", &Mwd.resolver_options.concurrency);
+		get_int_preference(config_file, "Resolver", "Timeout", &Mwd.resolver_options.timeout_ms);
+		get_int_preference(config_file, "Resolver", "Attempts", &Mwd.resolver_options.attempts);
+		get_int_preference(config_file, "Resolver", "CacheMemory", &Mwd.host_cache_memory);
+		get_int_preference(config_file, "Resolver", "PositiveTtl", &Mwd.host_ttl);
+		get_int_preference(config_file, "Resolver", "NegativeTtl", &Mwd.host_negative_ttl);
+		get_boolean_preference(config_file, "Resolver", "PersistentCache", &Mwd.host_cache_persistent);
+		
+		get_int_preference(config_file, "Refresh", "AttributionPeriod", &Mwd.attribution_period);
+		get_int_preference(config_file, "Refresh", "ProcessesPeriod", &Mwd.processes_period);
+		get_int_preference(config_file, "Refresh", "StatisticsPeriod", &Mwd.statistics_period);
+		get_int_preference(config_file, "Refresh", "CpuBudget", &Mwd.cpu_budget);
+		get_int_preference(config_file, "Refresh", "BackgroundPeriod", &Mwd.background_period);
+		
 		columns_order = g_key_file_get_integer_list(config_file, "MainView", "ColumnsOrder", 
 												   &ncolumns, NULL);
 		if (columns_order != NULL)
@@ -1328,6 +2288,7 @@ static void save_preferences ()
 	g_key_file_set_boolean(config_file, "Edit", "Filtering", Mwd.filtering);
 	g_key_file_set_boolean(config_file, "Edit", "CaseSensitiveFilter", Mwd.caseSensitiveFilter);
 	g_key_file_set_boolean(config_file, "Edit", "FilterOperators", Mwd.filterOperators);
+	g_key_file_set_boolean(config_file, "Edit", "FilterRegex", Mwd.filterRegex);
 	g_key_file_set_string(config_file, "Edit", "Filter", Mwd.filter->str);
 	g_key_file_set_integer(config_file, "MainView", "SortColumnIndex", Mwd.current_sort_column);
 	g_key_file_set_integer(config_file, "MainView", "SortDirection", Mwd.current_sort_direction);
@@ -1337,6 +2298,35 @@ static void save_preferences ()
 								MVC_VIEW_COLUMNSNUMBER);
 	g_key_file_set_comment(config_file, "MainView", "ColumnsOrder", "View positions at index", NULL);
 	
+	if (Mwd.resolver_options.nameservers != NULL)
+		g_key_file_set_string_list(config_file, "Resolver", "Nameservers", 
+		                           (const gchar * const *)Mwd.resolver_options.nameservers, 
+		                           g_strv_length(Mwd.resolver_options.nameservers));
+	g_key_file_set_integer(config_file, "Resolver", "Concurrency", Mwd.resolver_options.concurrency);
+	g_key_file_set_integer(config_file, "Resolver", "Timeout", Mwd.resolver_options.timeout_ms);
+	g_key_file_set_integer(config_file, "Resolver", "Attempts", Mwd.resolver_options.attempts);
+	g_key_file_set_integer(config_file, "Resolver", "CacheMemory", Mwd.host_cache_memory);
+	g_key_file_set_integer(config_file, "Resolver", "PositiveTtl", Mwd.host_ttl);
+	g_key_file_set_integer(config_file, "Resolver", "NegativeTtl", Mwd.host_negative_ttl);
+	g_key_file_set_boolean(config_file, "Resolver", "PersistentCache", Mwd.host_cache_persistent);
+	g_key_file_set_comment(config_file, "Resolver", NULL, 
+	                       "Reverse DNS; 0 and no Nameservers for the system settings. "
+	                       "Nameservers are address or address#port; Timeout is in ms, "
+	                       "CacheMemory in KiB and the TTLs in seconds. PersistentCache keeps "
+	                       "the names in ~/" HOST_CACHE_FILE_NAME, NULL);
+	
+	g_key_file_set_integer(config_file, "Refresh", "AttributionPeriod", Mwd.attribution_period);
+	g_key_file_set_integer(config_file, "Refresh", "ProcessesPeriod", Mwd.processes_period);
+	g_key_file_set_integer(config_file, "Refresh", "StatisticsPeriod", Mwd.statistics_period);
+	g_key_file_set_integer(config_file, "Refresh", "CpuBudget", Mwd.cpu_budget);
+	g_key_file_set_integer(config_file, "Refresh", "BackgroundPeriod", Mwd.background_period);
+	g_key_file_set_comment(config_file, "Refresh", NULL, 
+	                       "Periods in ms of the process file descriptors scan, of the process "
+	                       "names and commands read and of the statistics; the connections "
+	                       "follow the auto refresh interval. CpuBudget is the percent of one "
+	                       "CPU used by the adaptive auto refresh. BackgroundPeriod is the "
+	                       "statistics period while the window is not visible", NULL);
+	
 	dtosH = drop_to_sudo_user();
 	save_config_file(config_file);
 	
@@ -1383,6 +2373,8 @@ static void set_menu_preferences ()
 	                             Mwd.caseSensitiveFilter);
 	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(glade_xml_get_widget(GladeXml, "btnOperators")),
 	                             Mwd.filterOperators);
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(glade_xml_get_widget(GladeXml, "btnRegex")),
+	                             Mwd.filterRegex);
 	if (Mwd.filtering && Mwd.filter->len > 0)
 	{
 		GtkEntry *filter_entry = GTK_ENTRY(glade_xml_get_widget(GladeXml, "txtFilter"));
@@ -1393,6 +2385,81 @@ static void set_menu_preferences ()
 }
 
 
+#define ADAPTIVE_REFRESH_INITIAL 1000 /*ms*/
+#define ADAPTIVE_REFRESH_MIN 64
+#define ADAPTIVE_REFRESH_MAX 4000
+#define ADAPTIVE_REFRESH_SAMPLE 0.5 /*s; the CPU use is measured over at least this time*/
+#define HIGH_CHURN_RATIO 20 /*a refresh changes more than 1/20 of the rows*/
+
+static void refresh_rate_label ()
+{
+	char *text;
+	if (Mwd.label_refresh == NULL)
+		return;
+	if (!Mwd.auto_refresh)
+		text = g_strdup(_("Refresh: off"));
+	else if (Mwd.adaptive_refresh)
+		text = g_strdup_printf(_("Refresh: %.2f s adaptive"), Mwd.auto_refresh_interval / 1000.);
+	else
+		text = g_strdup_printf(_("Refresh: %.2f s"), Mwd.auto_refresh_interval / 1000.);
+	gtk_label_set_text(Mwd.label_refresh, text);
+	g_free(text);
+}
+
+static void reset_refresh_governor ()
+{
+	if (Mwd.governor_timer != NULL)
+		g_timer_destroy(Mwd.governor_timer);
+	Mwd.governor_timer = NULL;
+	Mwd.changed_refreshes = Mwd.unchanged_refreshes = Mwd.refresh_changes = 0;
+}
+
+/* The interval that would use the CPU budget at the cost measured since the last update 
+ * is the shortest allowed. Above it, the interval grows when the connections did not change 
+ * and shrinks when a refresh changes many rows. It changes at most 2 times per update. 
+ * Returns TRUE if the interval changed. */
+static gboolean update_adaptive_refresh_interval ()
+{
+	double cpu_time = get_process_cpu_time(), elapsed, cpu_share, interval, budget_interval;
+	unsigned int new_interval;
+	
+	if (Mwd.governor_timer == NULL)
+	{
+		Mwd.governor_timer = g_timer_new();
+		Mwd.governor_cpu_time = cpu_time;
+		return FALSE;
+	}
+	elapsed = g_timer_elapsed(Mwd.governor_timer, NULL);
+	if (elapsed < ADAPTIVE_REFRESH_SAMPLE)
+		return FALSE;
+	
+	cpu_share = (cpu_time - Mwd.governor_cpu_time) * 100. / elapsed;
+	interval = Mwd.auto_refresh_interval;
+	budget_interval = interval * cpu_share / MAX(Mwd.cpu_budget, 1);
+	if (Mwd.changed_refreshes == 0 && Mwd.unchanged_refreshes > 0)
+		interval *= 1.5;
+	else if (Mwd.changed_refreshes > 0 && 
+	         Mwd.refresh_changes * HIGH_CHURN_RATIO > Mwd.changed_refreshes * (Mwd.connections->len + 1))
+		interval /= 2.;
+	interval = MAX(interval, budget_interval);
+	interval = CLAMP(interval, Mwd.auto_refresh_interval / 2., Mwd.auto_refresh_interval * 2.);
+	new_interval = (unsigned)CLAMP(interval, ADAPTIVE_REFRESH_MIN, ADAPTIVE_REFRESH_MAX);
+	
+	nactv_trace("adaptive refresh: cpu %.2f%%, %u changed and %u unchanged refreshes, "
+	            "%u row changes, interval %u ms\n", cpu_share, Mwd.changed_refreshes, 
+	            Mwd.unchanged_refreshes, Mwd.refresh_changes, new_interval);
+	g_timer_reset(Mwd.governor_timer);
+	Mwd.governor_cpu_time = cpu_time;
+	Mwd.changed_refreshes = Mwd.unchanged_refreshes = Mwd.refresh_changes = 0;
+	
+	if (new_interval == Mwd.auto_refresh_interval)
+		return FALSE;
+	Mwd.auto_refresh_interval = new_interval;
+	return TRUE;
+}
+
+static void update_auto_refresh ();
+
 static gboolean on_AutoRefresh_timeout (gpointer data)
 {
 	if (Mwd.exit_requested)
@@ -1404,14 +2471,43 @@ static gboolean on_AutoRefresh_timeout (gpointer data)
 	
 	refresh_connections();
 	
+	if (Mwd.adaptive_refresh && update_adaptive_refresh_interval())
+	{
+		update_auto_refresh(); /*replaces this timeout*/
+		return FALSE;
+	}
 	return TRUE;
 }
 
+static gboolean on_statistics_refresh_timeout (gpointer data)
+{
+	if (Mwd.exit_requested)
+		return FALSE;
+	if (!Mwd.update_disabled)
+		refresh_net_statistics();
+	return TRUE;
+}
+
+/* The statistics have their own period while auto refresh is on */
+static void update_statistics_refresh ()
+{
+	if (Mwd.statistics_refresh_id != 0)
+		g_source_remove(Mwd.statistics_refresh_id);
+	Mwd.statistics_refresh_id = 0;
+	if (Mwd.auto_refresh && !Mwd.exit_requested)
+	{
+		int period = Mwd.background_refresh ? MAX(Mwd.background_period, Mwd.statistics_period) : 
+		                                      Mwd.statistics_period;
+		Mwd.statistics_refresh_id = g_timeout_add(MAX(period, 100), &on_statistics_refresh_timeout, NULL);
+	}
+}
+
 static void update_auto_refresh ()
 {
-	if (Mwd.auto_refresh)
+	refresh_rate_label();
+	Mwd.auto_refresh_id++; /*stops the previous timeout*/
+	if (Mwd.auto_refresh && !Mwd.background_refresh)
 	{
-		Mwd.auto_refresh_id++;
 		g_timeout_add(Mwd.auto_refresh_interval, &on_AutoRefresh_timeout, 
 		              (gpointer)(uintptr_t)Mwd.auto_refresh_id);
 	}
@@ -1423,45 +2519,113 @@ static void set_auto_refresh (gboolean refresh)
 		refresh_connections();
 	Mwd.auto_refresh = refresh;
 	update_auto_refresh ();
+	update_statistics_refresh();
 }
 
 static void set_auto_refresh_interval (unsigned interval)
 {
+	Mwd.adaptive_refresh = FALSE;
 	Mwd.auto_refresh_interval = interval;
 	update_auto_refresh();
 }
 
-gboolean update_connections_hosts_on_idle (gpointer data)
+static void set_adaptive_auto_refresh ()
 {
-	if (Mwd.exit_requested)
-		return FALSE;
-	
-	update_connections_hosts();
+	Mwd.adaptive_refresh = TRUE;
+	Mwd.auto_refresh_interval = ADAPTIVE_REFRESH_INITIAL;
+	reset_refresh_governor();
+	update_auto_refresh();
+}
+
+/* The connections are not refreshed while the window is iconified, unmapped (on another 
+ * workspace) or fully obscured; the ones opened and closed meanwhile are not seen. 
+ * When the window is visible again one refresh brings the view up to date. */
+static void update_background_refresh ()
+{
+	gboolean background = (Mwd.window_iconified || Mwd.window_unmapped || Mwd.window_obscured);
+	if (background == Mwd.background_refresh || !Mwd.main_view_created || Mwd.exit_requested)
+		return;
 	
-	return FALSE;
+	Mwd.background_refresh = background;
+	nactv_trace("background refresh %s\n", background ? "on" : "off");
+	if (!background && Mwd.auto_refresh)
+	{
+		refresh_connections();
+		refresh_net_statistics();
+	}
+	reset_refresh_governor(); /*the background time is not measured*/
+	update_auto_refresh();
+	update_statistics_refresh();
 }
 
+#define RESOLVED_HOSTS_BATCH 256
 
-gboolean main_store_line_visible (GtkTreeIter *iter)
+static void update_pending_host_row (gpointer key, gpointer value, gpointer user_data)
 {
-	gboolean result;
-	GValue value = {0,};
-	gtk_tree_model_get_value(GTK_TREE_MODEL(Mwd.main_store), iter, MVC_VISIBLE, &value);
-	result = g_value_get_boolean(&value);
-	g_value_unset(&value);
-	return result;
+	NetConnection *conn = (NetConnection*)key;
+	if (update_net_connection_hosts(conn))
+		list_update_connection(conn);
 }
 
-static GString *get_saved_line_text (GtkTreeIter *iter)
+/* Applies a batch of the resolver answers to the rows waiting for them; 
+ * runs again while answers are left */
+gboolean update_resolved_hosts_on_idle (gpointer data)
 {
-	NetConnection *conn;
-	GString *s = g_string_new("");
-	GValue value = {0, };
-	char *slocalport, *sremoteport, spid[48]="`";
+	char *addresses[RESOLVED_HOSTS_BATCH];
+	unsigned int naddresses, i;
+	gboolean more;
 	
-	gtk_tree_model_get_value(GTK_TREE_MODEL(Mwd.main_store), iter, MVC_DATA, &value);
-	conn = (NetConnection*)g_value_get_pointer(&value);
+	g_mutex_lock(Mwd.host_hash_lock);
+	naddresses = Mwd.exit_requested ? 0 : MIN(Mwd.resolved_addresses->len, RESOLVED_HOSTS_BATCH);
+	memcpy(addresses, Mwd.resolved_addresses->pdata, naddresses * sizeof(char*));
+	g_ptr_array_remove_range(Mwd.resolved_addresses, 0, naddresses);
+	Mwd.drained_answers += naddresses;
+	more = (!Mwd.exit_requested && Mwd.resolved_addresses->len > 0);
+	if (!more)
+		Mwd.resolved_hosts_id = 0;
+	g_mutex_unlock(Mwd.host_hash_lock);
+	
+	for (i=0; i<naddresses; i++)
+	{
+		gpointer address, rows;
+		/* the rows still without host wait again, in a new set */
+		if (g_hash_table_lookup_extended(Mwd.pending_host_rows, addresses[i], &address, &rows))
+		{
+			g_hash_table_steal(Mwd.pending_host_rows, addresses[i]);
+			g_hash_table_foreach((GHashTable*)rows, &update_pending_host_row, NULL);
+			g_hash_table_destroy((GHashTable*)rows);
+			g_free(address);
+		}
+		g_free(addresses[i]);
+	}
+	return more;
+}
+
+
+/* The visible function of the filtered model */
+static gboolean main_store_row_visible (GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	NetConnection *conn = NULL;
+	gtk_tree_model_get(model, iter, MVC_DATA, &conn, -1);
+	if (conn == NULL || conn->user_data == NULL)
+		return FALSE;
+	return row_visible(((ListLineUserData*)conn->user_data)->row);
+}
+
+/* The connection of a row of the filtered model */
+static NetConnection *get_visible_line_connection (GtkTreeIter *iter)
+{
+	NetConnection *conn = NULL;
+	gtk_tree_model_get(Mwd.main_store_filtered, iter, MVC_DATA, &conn, -1);
 	g_assert(conn != NULL);
+	return conn;
+}
+
+static GString *get_saved_line_text (NetConnection *conn)
+{
+	GString *s = g_string_new("");
+	const char *slocalport, *sremoteport;
+	char spid[48]="`";
 	
 	slocalport = get_port_text(conn->localport);
 	sremoteport = get_port_text(conn->remoteport);
@@ -1480,9 +2644,6 @@ static GString *get_saved_line_text (GtkTreeIter *iter)
 	g_string_append_printf(s, "%s   ", VALUE_OR_DEF(conn->programname, "`"));
 	g_string_append_printf(s, "%s", VALUE_OR_DEF(conn->programcommand, "`"));
 	
-	g_free(slocalport);
-	g_free(sremoteport);
-	g_value_unset(&value);
 	return s;
 }
 
@@ -1518,19 +2679,17 @@ gboolean write_saved_data_text (FILE *f, gboolean new_file, int *write_error)
 		if ( fprintf(f, "-") < 0) goto error_label;
 	if ( fprintf(f, "\n") < 0) goto error_label;
 	
-	biter = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(Mwd.main_store), &iter);
+	/* the visible rows in the view order */
+	biter = gtk_tree_model_get_iter_first(Mwd.main_store_filtered, &iter);
 	while (biter)
 	{
-		if (main_store_line_visible(&iter))
-		{
-			GString *line_text;
-			line_text = get_saved_line_text(&iter);
-			nch = fprintf(f, "%s\n", line_text->str);
-			g_string_free(line_text, TRUE);
-			if (nch < 0) goto error_label;
-		}
+		GString *line_text;
+		line_text = get_saved_line_text(get_visible_line_connection(&iter));
+		nch = fprintf(f, "%s\n", line_text->str);
+		g_string_free(line_text, TRUE);
+		if (nch < 0) goto error_label;
 		
-		biter = gtk_tree_model_iter_next(GTK_TREE_MODEL(Mwd.main_store), &iter);
+		biter = gtk_tree_model_iter_next(Mwd.main_store_filtered, &iter);
 	}
 	if ( fprintf(f, "\n") < 0) goto error_label;
 	
@@ -1541,12 +2700,11 @@ error_label:
 	return FALSE;
 }
 
-static GString *get_saved_line_csv (GtkTreeIter *iter, struct tm *t)
+static GString *get_saved_line_csv (NetConnection *conn, struct tm *t)
 {
-	NetConnection *conn;
 	GString *s = g_string_new("");
-	GValue value = {0, };
-	char *slocalport, *sremoteport, spid[48]="", *slocalportname, *sremoteportname;
+	const char *slocalport, *sremoteport, *slocalportname, *sremoteportname;
+	char spid[48]="";
 	char *sprogramname, *sprogramcommand;
 	char time_str[128], date_str[128];
 	size_t ftres1, ftres2;
@@ -1555,10 +2713,6 @@ static GString *get_saved_line_csv (GtkTreeIter *iter, struct tm *t)
 	ftres2 = strftime(date_str, sizeof(date_str), "%F", t);
 	ERROR_IF(ftres1 == 0 || ftres2 == 0);
 	
-	gtk_tree_model_get_value(GTK_TREE_MODEL(Mwd.main_store), iter, MVC_DATA, &value);
-	conn = (NetConnection*)g_value_get_pointer(&value);
-	g_assert(conn != NULL);
-	
 	slocalport = get_port_text(conn->localport);
 	slocalportname = get_port_name(conn->protocol, conn->localport);
 	sremoteport = get_port_text(conn->remoteport);
@@ -1584,13 +2738,8 @@ static GString *get_saved_line_csv (GtkTreeIter *iter, struct tm *t)
 	g_string_append_printf(s, "\"%s\",", VALUE_OR_DEF(slocalportname, ""));
 	g_string_append_printf(s, "\"%s\"", VALUE_OR_DEF(sremoteportname, ""));
 	
-	g_free(slocalport);
-	g_free(slocalportname);
-	g_free(sremoteport);
-	g_free(sremoteportname);
 	g_free(sprogramname);
 	g_free(sprogramcommand);
-	g_value_unset(&value);
 	return s;
 }
 
@@ -1614,19 +2763,17 @@ gboolean write_saved_data_csv (FILE *f, gboolean new_file, int *write_error)
 	time(&time_val);
 	localtime_r(&time_val, &t);	
 	
-	biter = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(Mwd.main_store), &iter);
+	/* the visible rows in the view order */
+	biter = gtk_tree_model_get_iter_first(Mwd.main_store_filtered, &iter);
 	while (biter)
 	{
-		if (main_store_line_visible(&iter))
-		{
-			GString *line_text;
-			line_text = get_saved_line_csv(&iter, &t);
-			nch = fprintf(f, "%s\n", line_text->str);
-			g_string_free(line_text, TRUE);
-			if (nch < 0) goto error_label;
-		}
+		GString *line_text;
+		line_text = get_saved_line_csv(get_visible_line_connection(&iter), &t);
+		nch = fprintf(f, "%s\n", line_text->str);
+		g_string_free(line_text, TRUE);
+		if (nch < 0) goto error_label;
 		
-		biter = gtk_tree_model_iter_next(GTK_TREE_MODEL(Mwd.main_store), &iter);
+		biter = gtk_tree_model_iter_next(Mwd.main_store_filtered, &iter);
 	}
 	if ( fprintf(f, "\n") < 0) goto error_label;
 	
@@ -2120,6 +3267,15 @@ static void on_menuAutoRefresh0_064_toggled (GtkCheckMenuItem *radiomenuitem, gp
 	}
 }
 
+static void on_menuAutoRefreshAdaptive_toggled (GtkCheckMenuItem *radiomenuitem, gpointer userdata)
+{
+	if (radiomenuitem->active)
+	{
+		n_strlcpy(Mwd.sel_arinterval_menu, glade_get_widget_name(GTK_WIDGET(radiomenuitem)), sizeof(Mwd.sel_arinterval_menu));
+		set_adaptive_auto_refresh();
+	}
+}
+
 static void menuView_activate (GtkCheckMenuItem *checkmenuitem, gpointer userdata)
 {
 	gtk_widget_set_sensitive(glade_xml_get_widget(GladeXml, "menuViewDeletedConn"), 
@@ -2130,22 +3286,27 @@ static void on_menuViewHostName_toggled (GtkCheckMenuItem *checkmenuitem, gpoint
 {
 	Mwd.view_remote_host = checkmenuitem->active;
 	gtk_tree_view_column_set_visible(Mwd.main_view_columns[MVC_REMOTEHOST], checkmenuitem->active);
+	invalidate_filter_columns();
 	update_connections_hosts();
 	update_connections_visibility();
+	update_collector_needs();
 }
 
 static void on_menuViewLocalHostName_toggled (GtkCheckMenuItem *checkmenuitem, gpointer userdata)
 {
 	Mwd.view_local_host = checkmenuitem->active;
 	gtk_tree_view_column_set_visible(Mwd.main_view_columns[MVC_LOCALHOST], Mwd.view_local_host);
+	invalidate_filter_columns();
 	update_connections_hosts();
 	update_connections_visibility();
+	update_collector_needs();
 }
 
 static void on_menuViewLocalAddress_toggled (GtkCheckMenuItem *checkmenuitem, gpointer userdata)
 {
 	Mwd.view_local_address = checkmenuitem->active;
 	gtk_tree_view_column_set_visible(Mwd.main_view_columns[MVC_LOCALADDRESS], Mwd.view_local_address);
+	invalidate_filter_columns();
 	update_connections_visibility();
 }
 
@@ -2153,7 +3314,9 @@ static void on_menuViewCommand_toggled (GtkCheckMenuItem *checkmenuitem, gpointe
 {
 	Mwd.view_command = checkmenuitem->active;
 	gtk_tree_view_column_set_visible(Mwd.main_view_columns[MVC_PROGRAMCOMMAND], Mwd.view_command);
+	invalidate_filter_columns();
 	update_connections_visibility();
+	update_collector_needs();
 }
 
 static void on_menuViewPortName_toggled (GtkCheckMenuItem *checkmenuitem, gpointer userdata)
@@ -2176,11 +3339,11 @@ static void on_menuViewUnestablishedConn_toggled (GtkCheckMenuItem *checkmenuite
 	toggle_tool_button = GTK_TOGGLE_TOOL_BUTTON(glade_xml_get_widget(GladeXml, "tbtnEstConnections"));
 	gtk_toggle_tool_button_set_active(toggle_tool_button, !checkmenuitem->active);
 	
-	int i;
 	Mwd.view_unestablished_connections = checkmenuitem->active;	
-	for (i=0; i<Mwd.connections->len; i++)
-		list_update_connection(g_array_index(Mwd.connections, NetConnection*, i));
+	combine_rows_visibility();
 	refresh_visible_conn_label();
+	schedule_host_requests_priorities();
+	update_collector_needs();
 }
 
 static void on_menuViewColors_toggled (GtkCheckMenuItem *checkmenuitem, gpointer userdata)
@@ -2188,6 +3351,8 @@ static void on_menuViewColors_toggled (GtkCheckMenuItem *checkmenuitem, gpointer
 	Mwd.view_colors = checkmenuitem->active;
 	if (!Mwd.view_colors)
 		clear_colors();
+	else if (Mwd.subnet_colors != NULL)
+		set_subnet_colors();
 }
 
 static void set_menuitem_label(GtkMenuItem* mitem, const char* label_text)
@@ -2361,10 +3526,24 @@ static void on_btnCaseSensitive_toggled (GtkToggleButton *button, gpointer user_
 	update_filter();
 }
 
+/* The operators and the regular expression modes are exclusive; turning off the other 
+ * mode updates the filter */
 static void on_btnOperators_toggled (GtkToggleButton *button, gpointer user_data)
 {
 	Mwd.filterOperators = gtk_toggle_button_get_active(button);
-	update_filter();
+	if (Mwd.filterOperators && Mwd.filterRegex)
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(glade_xml_get_widget(GladeXml, "btnRegex")), FALSE);
+	else
+		update_filter();
+}
+
+static void on_btnRegex_toggled (GtkToggleButton *button, gpointer user_data)
+{
+	Mwd.filterRegex = gtk_toggle_button_get_active(button);
+	if (Mwd.filterRegex && Mwd.filterOperators)
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(glade_xml_get_widget(GladeXml, "btnOperators")), FALSE);
+	else
+		update_filter();
 }
 
 static void on_filter_changed (GtkEditable *editable, gpointer user_data)
@@ -2383,6 +3562,8 @@ static void on_filter_changed (GtkEditable *editable, gpointer user_data)
 		char *newStr = NULL;
 		if (Mwd.filterOperators)
 			newStr = string_replace(Mwd.filter->str, "\n", " OR ");
+		else if (Mwd.filterRegex)
+			newStr = string_replace(Mwd.filter->str, "\n", "|");
 		else
 			newStr = string_replace(Mwd.filter->str, "\n", " ");
 		g_string_assign(Mwd.filter, newStr);
@@ -2390,7 +3571,7 @@ static void on_filter_changed (GtkEditable *editable, gpointer user_data)
 		g_free(newStr);
 	}
 	
-	update_filter();
+	schedule_filter_update();
 
 	inside_filter_changed = FALSE;
 }
@@ -2427,6 +3608,24 @@ gboolean on_window_configure_event (GtkWidget *widget, GdkEventConfigure *event,
 gboolean on_window_window_state_event (GtkWidget *widget, GdkEventWindowState *event, gpointer user_data)
 {	
 	Mwd.window_maximized = ((event->new_window_state & GDK_WINDOW_STATE_MAXIMIZED) != 0);
+	Mwd.window_iconified = ((event->new_window_state & 
+	                         (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)) != 0);
+	update_background_refresh();
+	return FALSE;
+}
+
+static gboolean on_window_map_event (GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+	Mwd.window_unmapped = (event->type == GDK_UNMAP);
+	update_background_refresh();
+	return FALSE;
+}
+
+static gboolean on_window_visibility_notify_event (GtkWidget *widget, GdkEventVisibility *event, 
+                                                   gpointer user_data)
+{
+	Mwd.window_obscured = (event->state == GDK_VISIBILITY_FULLY_OBSCURED);
+	update_background_refresh();
 	return FALSE;
 }
 
@@ -2470,6 +3669,7 @@ static void connect_signals (GtkWidget *window)
 	glade_xml_signal_connect(GladeXml, "on_menuAutoRefresh1_toggled", G_CALLBACK(&on_menuAutoRefresh1_toggled));
 	glade_xml_signal_connect(GladeXml, "on_menuAutoRefresh0_25_toggled", G_CALLBACK(&on_menuAutoRefresh0_25_toggled));
 	glade_xml_signal_connect(GladeXml, "on_menuAutoRefresh0_064_toggled", G_CALLBACK(&on_menuAutoRefresh0_064_toggled));
+	glade_xml_signal_connect(GladeXml, "on_menuAutoRefreshAdaptive_toggled", G_CALLBACK(&on_menuAutoRefreshAdaptive_toggled));
 	glade_xml_signal_connect(GladeXml, "on_menuViewLocalAddress_toggled", G_CALLBACK(&on_menuViewLocalAddress_toggled));
 	glade_xml_signal_connect(GladeXml, "on_menuViewHostName_toggled", G_CALLBACK(&on_menuViewHostName_toggled));
 	glade_xml_signal_connect(GladeXml, "on_menuViewLocalHostName_toggled", G_CALLBACK(&on_menuViewLocalHostName_toggled));
@@ -2486,6 +3686,7 @@ static void connect_signals (GtkWidget *window)
 	glade_xml_signal_connect(GladeXml, "on_btnClearFilter_clicked", G_CALLBACK(&on_btnClearFilter_clicked));
 	glade_xml_signal_connect(GladeXml, "on_btnCaseSensitive_toggled", G_CALLBACK(&on_btnCaseSensitive_toggled));
 	glade_xml_signal_connect(GladeXml, "on_btnOperators_toggled", G_CALLBACK(&on_btnOperators_toggled));
+	glade_xml_signal_connect(GladeXml, "on_btnRegex_toggled", G_CALLBACK(&on_btnRegex_toggled));
 	glade_xml_signal_connect(GladeXml, "on_filter_changed", G_CALLBACK(&on_filter_changed));
 	glade_xml_signal_connect(GladeXml, "on_menuFilter_toggled", G_CALLBACK(&on_menuFilter_toggled));
 	glade_xml_signal_connect(GladeXml, "on_window_configure_event", G_CALLBACK(&on_window_configure_event));
@@ -2493,6 +3694,12 @@ static void connect_signals (GtkWidget *window)
 	
 	g_signal_connect(G_OBJECT (window), "delete_event", G_CALLBACK (delete_event), NULL);
 	g_signal_connect(G_OBJECT (window), "destroy", G_CALLBACK (destroy), NULL);
+	
+	gtk_widget_add_events(window, GDK_VISIBILITY_NOTIFY_MASK | GDK_STRUCTURE_MASK);
+	g_signal_connect(G_OBJECT(window), "map-event", G_CALLBACK(on_window_map_event), NULL);
+	g_signal_connect(G_OBJECT(window), "unmap-event", G_CALLBACK(on_window_map_event), NULL);
+	g_signal_connect(G_OBJECT(window), "visibility-notify-event", 
+	                 G_CALLBACK(on_window_visibility_notify_event), NULL);
 }
 
 
@@ -2543,8 +3750,10 @@ static void setup_view (GtkWidget *window)
 	Mwd.main_store = gtk_list_store_new(MVC_COLUMNSNUMBER, G_TYPE_STRING, G_TYPE_STRING, 
 					G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, 
 					G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, 
-					G_TYPE_BOOLEAN, G_TYPE_POINTER, G_TYPE_STRING);
+					G_TYPE_POINTER, G_TYPE_STRING);
 	Mwd.main_store_filtered = gtk_tree_model_filter_new(GTK_TREE_MODEL(Mwd.main_store), NULL);
+	gtk_tree_model_filter_set_visible_func(GTK_TREE_MODEL_FILTER(Mwd.main_store_filtered), 
+	                                       &main_store_row_visible, NULL, NULL);
 	gtk_tree_view_set_model(Mwd.main_view, Mwd.main_store_filtered);
 	
 	Mwd.column_to_index_hash = g_hash_table_new(NULL, NULL);
@@ -2565,7 +3774,10 @@ static void setup_view (GtkWidget *window)
 	
 	set_sort_column(Mwd.current_sort_column, TRUE);
 	
-	gtk_tree_model_filter_set_visible_column(GTK_TREE_MODEL_FILTER(Mwd.main_store_filtered), MVC_VISIBLE);
+	g_signal_connect(G_OBJECT(Mwd.main_view), "columns-changed", 
+	                 G_CALLBACK(on_main_view_columns_changed), NULL);
+	g_signal_connect(G_OBJECT(gtk_tree_view_get_vadjustment(Mwd.main_view)), "value-changed", 
+	                 G_CALLBACK(on_main_view_scrolled), NULL);
 	
 	gtk_tree_view_unset_rows_drag_dest(Mwd.main_view);
 	gtk_tree_view_unset_rows_drag_source(Mwd.main_view);
@@ -2613,6 +3825,7 @@ static void init_controls ()
 
 static void setup_status_bar ()
 {
+	Mwd.label_refresh = add_status_bar_label("Refresh: 0.00 s adaptive");
 	Mwd.label_received = add_status_bar_label("Received: 0 B +0 B/s      ");
 	Mwd.label_sent = add_status_bar_label("Sent: 0 B +0 B/s      ");
 	Mwd.label_count = add_status_bar_label("Established: 0/0  ");
@@ -2639,14 +3852,18 @@ GtkWidget* main_window_create (void)
 	init_controls();
 	setup_status_bar();
 	setup_view(window);
+	init_host_loader(); /*used by the loader thread*/
 	init_connections_loader();
-	init_host_loader();
+	init_filter_thread();
+	load_subnet_colors();
 	connect_signals(window);
 	
 	refresh_connections();
 	update_auto_refresh();
+	update_statistics_refresh();
 	
 	set_menu_preferences();
+	update_collector_needs();
 
 	Mwd.main_view_created = TRUE;
 	
@@ -2663,6 +3880,7 @@ void main_window_data_cleanup ()
 	
 	stop_connections_loader();
 	stop_host_loader();
+	stop_filter_thread();
 	free_connections_loader();
 	free_host_loader();
 	
@@ -2676,14 +3894,22 @@ void main_window_data_cleanup ()
 		list_free_net_connection(g_array_index(Mwd.connections, NetConnection*, i));
 	g_array_free(Mwd.connections, TRUE);
 	Mwd.connections = NULL;
+	rows_bits_free();
+	prefix_trie_unref(Mwd.subnet_colors);
+	Mwd.subnet_colors = NULL;
 	
 	if (Mwd.statistics_timer != NULL)
 		g_timer_destroy(Mwd.statistics_timer);
+	reset_refresh_governor();
 	
 	g_hash_table_destroy(Mwd.column_to_index_hash);
 
 	FreeFilterData();
+	invalidate_filter_columns();
+	g_free(Mwd.applied_filter);
 	g_string_free(Mwd.filter, TRUE);
+	g_strfreev(Mwd.resolver_options.nameservers);
+	Mwd.resolver_options.nameservers = NULL;
 	g_free(Mwd.default_fixed_font);
 }
 
@@ -2696,4 +3922,6 @@ static void disable_update ()
 static void restore_update ()
 {
 	Mwd.update_disabled = FALSE;
+	if (Mwd.main_view_created && !Mwd.exit_requested && has_unshown_load())
+		refresh_main_view();
 }
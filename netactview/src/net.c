@@ -17,7 +17,9 @@
 
 #include "nactv-debug.h"
 #include "net.h"
+#include "netdiag.h"
 #include "process.h"
+#include "utils.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -66,25 +68,53 @@ static const char *tcp_state_name[NC_TCP_STATES_NUMBER] =
 };
 
 
-static GHashTable *services_hash = NULL;
+#define PORTS_NUMBER 65536
+#define PORT_TEXT_SIZE 6
+
+/* The services database indexed by port, for tcp and udp, and the port texts shared by 
+ * all the rows. The names and the texts with names are interned strings. */
+static const char **service_names[2] = { NULL, NULL };
+static const char **full_port_texts[2] = { NULL, NULL };
+static char (*port_texts)[PORT_TEXT_SIZE] = NULL;
+
+static const int service_protocol_index[NC_PROTOCOLS_NUMBER] = {
+	0, 1, 0, 1
+};
 
 void nactv_net_init ()
 {
 	/*Load the services database*/
 	struct servent *sentry;
-	char key_port[128];
+	int i, port;
 	
-	g_assert(services_hash == NULL);
-	services_hash = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &g_free);
+	g_assert(port_texts == NULL);
+	port_texts = g_malloc(PORTS_NUMBER * PORT_TEXT_SIZE);
+	for (port=0; port<PORTS_NUMBER; port++)
+		g_snprintf(port_texts[port], PORT_TEXT_SIZE, "%d", port);
+	for (i=0; i<2; i++)
+	{
+		service_names[i] = (const char**)g_malloc0(PORTS_NUMBER * sizeof(const char*));
+		full_port_texts[i] = (const char**)g_malloc0(PORTS_NUMBER * sizeof(const char*));
+	}
 	
 	setservent(0);
 	
 	while ( (sentry = getservent()) != NULL )
 	{
-		int prlen = g_snprintf(key_port, sizeof(key_port), "%d/%s", 
-		                       ntohs(sentry->s_port), sentry->s_proto);
-		if (prlen > 0 && prlen < (int)sizeof(key_port))
-			g_hash_table_insert(services_hash, g_strdup(key_port), g_strdup(sentry->s_name));
+		port = ntohs(sentry->s_port);
+		if (strcmp(sentry->s_proto, "tcp") == 0)
+			i = 0;
+		else if (strcmp(sentry->s_proto, "udp") == 0)
+			i = 1;
+		else
+			continue;
+		if (port > 0 && port < PORTS_NUMBER)
+		{
+			char *full_text = g_strdup_printf("%d %s", port, sentry->s_name);
+			service_names[i][port] = g_intern_string(sentry->s_name);
+			full_port_texts[i][port] = g_intern_string(full_text);
+			g_free(full_text);
+		}
 	}
 	
 	endservent();
@@ -92,55 +122,44 @@ void nactv_net_init ()
 
 void nactv_net_free ()
 {	
-	if (services_hash != NULL)
+	int i;
+	for (i=0; i<2; i++)
 	{
-		g_hash_table_destroy(services_hash);
-		services_hash = NULL;
+		g_free(service_names[i]);
+		g_free(full_port_texts[i]);
+		service_names[i] = full_port_texts[i] = NULL;
 	}
+	g_free(port_texts);
+	port_texts = NULL;
 }
 
-static const char *service_protocol_name[NC_PROTOCOLS_NUMBER] = {
-	"tcp", "udp", "tcp", "udp"
-};
-
 static const char *net_service_get(int protocol, int port)
 {
-	char *service_name = NULL;
-	if (services_hash != NULL)
-	{
-		char key_port[128];
-		int prlen;
-		g_assert(protocol>=0 && protocol<NC_PROTOCOLS_NUMBER);
-		
-		prlen = g_snprintf(key_port, sizeof(key_port), "%d/%s", 
-		                   port, service_protocol_name[protocol]);
-		if (prlen > 0 && prlen < (int)sizeof(key_port))
-			service_name = (char*)g_hash_table_lookup(services_hash, key_port);
-	}
-	return service_name;
+	g_assert(protocol>=0 && protocol<NC_PROTOCOLS_NUMBER);
+	if (service_names[0] == NULL || port <= 0 || port >= PORTS_NUMBER)
+		return NULL;
+	return service_names[service_protocol_index[protocol]][port];
 }
 
-
-static GHashTable *get_open_sockets_for_processes (Process **processes, unsigned int *nprocesses)
+/* Returns the pids by socket inode */
+static GHashTable *get_open_sockets_for_processes (Process *processes, unsigned int nprocesses)
 {
 	GHashTable *open_sockets_hash;
 	unsigned int i;
 	
 	open_sockets_hash = g_hash_table_new(NULL, NULL);
 	
-	*nprocesses = get_running_processes(processes);
-	for (i=0; i<*nprocesses; i++)
+	for (i=0; i<nprocesses; i++)
 	{
 		unsigned long *sockets = NULL;
 		unsigned int nsockets, j;
-		Process *process = *processes+i;
+		Process *process = processes+i;
 		
 		nsockets = process_get_socket_inodes(process->pid, &sockets);
 		if (nsockets > 0)
 		{
-			update_process_info(process);
 			for (j=0; j<nsockets; j++)
-				g_hash_table_insert(open_sockets_hash, (gpointer)sockets[j], process);
+				g_hash_table_insert(open_sockets_hash, (gpointer)sockets[j], GINT_TO_POINTER(process->pid));
 			
 			g_free(sockets);
 		}
@@ -152,106 +171,310 @@ static GHashTable *get_open_sockets_for_processes (Process **processes, unsigned
 #define IN6_ADDR_IS_ZERO(addr) ((addr).s6_addr32[0]==0 && (addr).s6_addr32[1]==0 && \
 	(addr).s6_addr32[2]==0 && (addr).s6_addr32[3]==0)
 
+#define MAX_PROC_NET_FILE_SIZE (512*1024*1024)
 
-static void get_connections_from_kernel(int protocol, GArray *connections, GHashTable *open_sockets_hash)
+/* The socket table line fields that are displayed: local address, remote address, state 
+ * and inode (fields 1, 2, 3 and 9). Queues and timers change on idle sockets too and 
+ * the first field is the line number. Returns 0 if the key does not fit. */
+static size_t proc_net_line_key (const char *line, const char *line_end, char *key, size_t key_size)
 {
-	char buffer[8192];
-	FILE *f;
+	const char *p = line;
+	size_t key_len = 0;
+	int field;
+	
+	for (field=0; field<=9 && p<line_end; field++)
+	{
+		const char *start;
+		while (p < line_end && (*p == ' ' || *p == '\t'))
+			p++;
+		start = p;
+		while (p < line_end && *p != ' ' && *p != '\t')
+			p++;
+		if (field == 1 || field == 2 || field == 3 || field == 9)
+		{
+			size_t field_len = p - start;
+			if (key_len + field_len + 1 >= key_size)
+				return 0;
+			memcpy(key + key_len, start, field_len);
+			key_len += field_len;
+			key[key_len++] = ' ';
+		}
+	}
+	key[key_len] = '\0';
+	return key_len;
+}
+
+#define PROC_NET_LINE_KEY_SIZE 192
+
+static guint64 hash_proc_net_table (guint64 hash, const FileReadBuf *table)
+{
+	const char *line, *line_end, *data_end;
+	
+	if (table->data == NULL)
+		return hash_fnv1a_64(hash, "-", 1);
+	
+	data_end = table->data + table->dataLen;
+	line = memchr(table->data, '\n', table->dataLen); /*skip the first line*/
+	while (line != NULL && ++line < data_end)
+	{
+		char key[PROC_NET_LINE_KEY_SIZE];
+		size_t key_len;
+		
+		line_end = memchr(line, '\n', data_end - line);
+		if (line_end == NULL)
+			break; /*incomplete line*/
+		key_len = proc_net_line_key(line, line_end, key, sizeof(key));
+		if (key_len > 0)
+			hash = hash_fnv1a_64(hash, key, key_len);
+		else
+			hash = hash_fnv1a_64(hash, line, line_end - line);
+		hash = hash_fnv1a_64(hash, "\n", 1);
+		line = line_end;
+	}
+	return hash;
+}
+
+
+/* Writes "*" for the unspecified address */
+static void format_address (int family, const void *addr, char *text, size_t text_size)
+{
+	const guint32 *words = (const guint32*)addr;
+	gboolean zero = (family == AF_INET6) ? 
+		(words[0] == 0 && words[1] == 0 && words[2] == 0 && words[3] == 0) : (words[0] == 0);
+	
+	if (zero || inet_ntop(family, addr, text, text_size) == NULL)
+		n_strlcpy(text, "*", text_size);
+}
+
+/* The decoded fields of a socket table line */
+typedef struct
+{
+	char *localaddress;
+	char *remoteaddress;
+	NetAddress localaddr, remoteaddr;
+	int localport;
+	int remoteport;
+	int state;
+	unsigned long inode;
+} ProcNetLine;
+
+static void proc_net_line_free (gpointer data)
+{
+	ProcNetLine *parsed = (ProcNetLine*)data;
+	g_free(parsed->localaddress);
+	g_free(parsed->remoteaddress);
+	g_free(parsed);
+}
+
+/* line is NULL terminated */
+static ProcNetLine *parse_proc_net_line (int protocol, const char *line)
+{
+	ProcNetLine *parsed;
+	unsigned long rxq = 0, txq = 0, time_len = 0, retr = 0;
+	unsigned long inode = 0;
+	int num = 0, local_port = 0, rem_port = 0, d = -1, state = -1, uid = 0, timer_run = 0, timeout = 0;
+	char rem_addr[136] = "", local_addr[136] = "", more[1032]="";
+	NetAddress localaddr = {}, remoteaddr = {};
+	
+	state = -1;
+	d = -1;
+	num = sscanf(line,
+		"%d: %64[0-9A-Fa-f]:%X %64[0-9A-Fa-f]:%X %X %lX:%lX %X:%lX %lX %d %d %lu %512s\n",
+		&d, local_addr, &local_port, rem_addr, &rem_port, &state,
+		&txq, &rxq, &timer_run, &time_len, &retr, &uid, &timeout, &inode, more);
+	
+	if (num < 10 || d < 0)
+	{
+		nactv_trace("Invalid connection line format for protocol %d\n", protocol);
+		return NULL;
+	}
+	
+	if (strlen(local_addr) > 8) /*IP v6*/
+	{
+		struct in6_addr nlocaladdr = {}, nremaddr = {};
+		
+		sscanf(local_addr, "%08X%08X%08X%08X",
+			   &nlocaladdr.s6_addr32[0], &nlocaladdr.s6_addr32[1],
+			   &nlocaladdr.s6_addr32[2], &nlocaladdr.s6_addr32[3]);
+		sscanf(rem_addr, "%08X%08X%08X%08X",
+			   &nremaddr.s6_addr32[0], &nremaddr.s6_addr32[1],
+			   &nremaddr.s6_addr32[2], &nremaddr.s6_addr32[3]);
+		
+		format_address(AF_INET6, &nlocaladdr, local_addr, sizeof(local_addr));
+		format_address(AF_INET6, &nremaddr, rem_addr, sizeof(rem_addr));
+		localaddr.family = remoteaddr.family = AF_INET6;
+		memcpy(localaddr.addr, &nlocaladdr, sizeof(localaddr.addr));
+		memcpy(remoteaddr.addr, &nremaddr, sizeof(remoteaddr.addr));
+	}else /*IP v4*/
+	{
+		struct in_addr nlocaladdr = {}, nremaddr = {};
+		
+		sscanf(local_addr, "%X", &(nlocaladdr.s_addr));
+		sscanf(rem_addr, "%X", &(nremaddr.s_addr));
+		format_address(AF_INET, &nlocaladdr, local_addr, sizeof(local_addr));
+		format_address(AF_INET, &nremaddr, rem_addr, sizeof(rem_addr));
+		localaddr.family = remoteaddr.family = AF_INET;
+		localaddr.addr[0] = nlocaladdr.s_addr;
+		remoteaddr.addr[0] = nremaddr.s_addr;
+	}
+	
+	if (state < 0 || state > NC_TCP_CLOSING)
+	{
+		nactv_trace("Unknown connection state %d\n", state);
+		state = NC_TCP_EMPTY;
+	}
+	
+	parsed = (ProcNetLine*)g_malloc0(sizeof(ProcNetLine));
+	parsed->localaddress = g_strdup(local_addr);
+	parsed->remoteaddress = g_strdup(rem_addr);
+	parsed->localaddr = localaddr;
+	parsed->remoteaddr = remoteaddr;
+	parsed->localport = local_port;
+	parsed->remoteport = rem_port;
+	parsed->state = state;
+	parsed->inode = inode;
+	return parsed;
+}
+
+static void set_connection_pid (NetConnection *conn, GHashTable *open_sockets_hash)
+{
+	long pid;
+	
+	if (conn->inode == 0)
+		return;
+	pid = GPOINTER_TO_INT(g_hash_table_lookup(open_sockets_hash, (gpointer)conn->inode));
+	if (pid != 0)
+	{
+		conn->pid = pid;
+		conn->programpid = pid;
+	}
+}
+
+static void set_connection_program (NetConnection *conn, GHashTable *processes_by_pid)
+{
+	Process *process;
+	
+	if (conn->pid == 0)
+		return;
+	process = (Process*)g_hash_table_lookup(processes_by_pid, GINT_TO_POINTER(conn->pid));
+	if (process != NULL)
+	{
+		conn->programname = (process->name!=NULL) ? g_strdup(process->name) : NULL;
+		conn->programcommand = (process->commandline!=NULL) ? g_strdup(process->commandline) : NULL;
+	}
+}
+
+/* Only the lines in one of the states (mask) are added to connections.
+ * line_cache holds the lines decoded at the previous load (key from proc_net_line_key). 
+ * Lines with the same key are not decoded again. On return line_cache has only the current lines. */
+static void get_connections_from_table(int protocol, FileReadBuf *table, guint32 states, 
+                                       GHashTable **line_cache, GArray *connections)
+{
+	char *line, *line_end, *data_end;
+	GHashTable *previous_cache = *line_cache;
 	g_assert(protocol>=0 && protocol<NC_PROTOCOLS_NUMBER);
 	
-	f = fopen(protocol_file[protocol], "r");
-	if (f != NULL)
+	*line_cache = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &proc_net_line_free);
+	
+	if (table->data != NULL)
 	{
-		fgets(buffer, sizeof(buffer), f); /*skip the first line*/
-		while (fgets(buffer, sizeof(buffer), f) != NULL)
+		data_end = table->data + table->dataLen;
+		line = memchr(table->data, '\n', table->dataLen); /*skip the first line*/
+		while (line != NULL && ++line < data_end)
 		{
 			NetConnection net_line = {};
-			Process *process = NULL;
-			unsigned long rxq = 0, txq = 0, time_len = 0, retr = 0;
-			unsigned long inode = 0;
-			int num = 0, local_port = 0, rem_port = 0, d = -1, state = -1, uid = 0, timer_run = 0, timeout = 0;
-			char rem_addr[136] = "", local_addr[136] = "", more[1032]="";
+			ProcNetLine *parsed = NULL;
+			gpointer cached_key = NULL, cached_line = NULL;
+			char key[PROC_NET_LINE_KEY_SIZE];
+			size_t key_len;
+			gboolean parsed_owned = FALSE;
 			
-			memset(&net_line, 0, sizeof(net_line));
+			line_end = memchr(line, '\n', data_end - line);
+			if (line_end == NULL)
+				break; /*incomplete line*/
 			
-			state = -1;
-			d = -1;
-			num = sscanf(buffer,
-				"%d: %64[0-9A-Fa-f]:%X %64[0-9A-Fa-f]:%X %X %lX:%lX %X:%lX %lX %d %d %lu %512s\n",
-				&d, local_addr, &local_port, rem_addr, &rem_port, &state,
-				&txq, &rxq, &timer_run, &time_len, &retr, &uid, &timeout, &inode, more);
-				
-			if (num < 10 || d < 0)
+			key_len = proc_net_line_key(line, line_end, key, sizeof(key));
+			if (key_len > 0)
+				parsed = (ProcNetLine*)g_hash_table_lookup(*line_cache, key); /*a duplicate line*/
+			if (parsed == NULL && key_len > 0 && previous_cache != NULL && 
+			    g_hash_table_lookup_extended(previous_cache, key, &cached_key, &cached_line))
 			{
-				nactv_trace("Invalid connection line format for protocol %d\n", protocol);
-				continue;
+				g_hash_table_steal(previous_cache, key);
+				g_hash_table_insert(*line_cache, cached_key, cached_line);
+				parsed = (ProcNetLine*)cached_line;
 			}
-			
-			if (strlen(local_addr) > 8) /*IP v6*/
+			if (parsed == NULL)
 			{
-				struct in6_addr nlocaladdr = {}, nremaddr = {};
-				
-				sscanf(local_addr, "%08X%08X%08X%08X",
-					   &nlocaladdr.s6_addr32[0], &nlocaladdr.s6_addr32[1],
-					   &nlocaladdr.s6_addr32[2], &nlocaladdr.s6_addr32[3]);
-				sscanf(rem_addr, "%08X%08X%08X%08X",
-					   &nremaddr.s6_addr32[0], &nremaddr.s6_addr32[1],
-					   &nremaddr.s6_addr32[2], &nremaddr.s6_addr32[3]);
-				
-				if (!IN6_ADDR_IS_ZERO(nlocaladdr))
-					inet_ntop(AF_INET6, &nlocaladdr, local_addr, sizeof(local_addr));
-				else
-					strcpy(local_addr, "*");
-				if (!IN6_ADDR_IS_ZERO(nremaddr))
-					inet_ntop(AF_INET6, &nremaddr, rem_addr, sizeof(rem_addr));
-				else
-					strcpy(rem_addr, "*");
-			}else /*IP v4*/
-			{
-				struct in_addr nlocaladdr = {}, nremaddr = {};
-				
-				sscanf(local_addr, "%X", &(nlocaladdr.s_addr));
-				sscanf(rem_addr, "%X", &(nremaddr.s_addr));
-				if (nlocaladdr.s_addr != 0)
-					inet_ntop(AF_INET, &nlocaladdr, local_addr, sizeof(local_addr));
-				else
-					strcpy(local_addr, "*");
-				if (nremaddr.s_addr != 0)
-					inet_ntop(AF_INET, &nremaddr, rem_addr, sizeof(rem_addr));
-				else
-					strcpy(rem_addr, "*");
+				*line_end = '\0';
+				parsed = parse_proc_net_line(protocol, line);
+				if (parsed != NULL)
+				{
+					if (key_len > 0)
+						g_hash_table_insert(*line_cache, g_strdup(key), parsed);
+					else
+						parsed_owned = TRUE;
+				}
 			}
-			
-			if (state < 0 || state > NC_TCP_CLOSING)
+			line = line_end;
+			if (parsed == NULL || (states & (1 << parsed->state)) == 0)
 			{
-				nactv_trace("Unknown connection state %d\n", state);
-				state = NC_TCP_EMPTY;
+				if (parsed_owned)
+					proc_net_line_free(parsed);
+				continue;
 			}
 			
-			net_line.inode = inode;
+			memset(&net_line, 0, sizeof(net_line));
+			net_line.inode = parsed->inode;
 			net_line.protocol = protocol;
-			net_line.localaddress = g_strdup(local_addr);
-			net_line.remoteaddress = g_strdup(rem_addr);
-			net_line.localport = local_port;
-			net_line.remoteport = rem_port;
-			net_line.state = state;
+			net_line.localaddress = g_strdup(parsed->localaddress);
+			net_line.remoteaddress = g_strdup(parsed->remoteaddress);
+			net_line.localaddr = parsed->localaddr;
+			net_line.remoteaddr = parsed->remoteaddr;
+			net_line.localport = parsed->localport;
+			net_line.remoteport = parsed->remoteport;
+			net_line.state = parsed->state;
 			
-			if (inode > 0)
-			{
-				process = (Process*)g_hash_table_lookup(open_sockets_hash, (gpointer)inode);
-				if (process != NULL)
-				{
-					net_line.pid = process->pid;
-					net_line.programpid = process->pid;
-					net_line.programname = (process->name!=NULL) ? g_strdup(process->name) : NULL;
-					net_line.programcommand = (process->commandline!=NULL) ? 
-						g_strdup(process->commandline) : NULL;
-				}
-			}
+			if (parsed_owned)
+				proc_net_line_free(parsed);
 			
 			g_array_append_val(connections, net_line);
 		}
-		fclose(f);	
+	}
+	
+	if (previous_cache != NULL)
+		g_hash_table_destroy(previous_cache);
+}
+
+static void get_connections_from_diag (GArray *diag_sockets, GArray *connections)
+{
+	unsigned int i;
+	
+	for (i=0; i<diag_sockets->len; i++)
+	{
+		DiagSocket *socket = &g_array_index(diag_sockets, DiagSocket, i);
+		NetConnection net_line = {};
+		char address[INET6_ADDRSTRLEN];
+		
+		net_line.protocol = socket->protocol;
+		format_address(socket->family, socket->localaddr, address, sizeof(address));
+		net_line.localaddress = g_strdup(address);
+		format_address(socket->family, socket->remoteaddr, address, sizeof(address));
+		net_line.remoteaddress = g_strdup(address);
+		net_line.localaddr.family = net_line.remoteaddr.family = socket->family;
+		memcpy(net_line.localaddr.addr, socket->localaddr, sizeof(net_line.localaddr.addr));
+		memcpy(net_line.remoteaddr.addr, socket->remoteaddr, sizeof(net_line.remoteaddr.addr));
+		net_line.localport = socket->localport;
+		net_line.remoteport = socket->remoteport;
+		net_line.state = socket->state;
+		if (net_line.state < 0 || net_line.state > NC_TCP_CLOSING)
+		{
+			nactv_trace("Unknown connection state %d\n", net_line.state);
+			net_line.state = NC_TCP_EMPTY;
+		}
+		net_line.inode = socket->inode;
+		net_line.cookie = socket->cookie;
+		
+		g_array_append_val(connections, net_line);
 	}
 }
 
@@ -300,13 +523,17 @@ void net_connection_copy(NetConnection *destination, NetConnection *source)
 	destination->remotehost = (source->remotehost!=NULL) ? g_strdup(source->remotehost) : NULL;
 	destination->remoteaddress = (source->remoteaddress!=NULL) ? g_strdup(source->remoteaddress) : NULL;
 	destination->remoteport = source->remoteport;
+	destination->localaddr = source->localaddr;
+	destination->remoteaddr = source->remoteaddr;
 	destination->state = source->state;
 	destination->pid = source->pid;
 	destination->programpid = source->programpid;
 	destination->programname = (source->programname!=NULL) ? g_strdup(source->programname) : NULL;
 	destination->programcommand = (source->programcommand!=NULL) ? g_strdup(source->programcommand) : NULL;
 	destination->inode = source->inode;
+	destination->cookie = source->cookie;
 	destination->operation = source->operation;
+	destination->hosts_pending = source->hosts_pending;
 	destination->user_data = source->user_data;
 }
 
@@ -338,32 +565,432 @@ const char *net_connection_get_state_name (NetConnection *conn)
 	}		
 }
 
+int net_get_state_by_name (const char *name)
+{
+	int state;
+	for (state=NC_TCP_ESTABLISHED; state<NC_TCP_STATES_NUMBER; state++)
+		if (g_ascii_strcasecmp(name, tcp_state_name[state]) == 0)
+			return state;
+	return -1;
+}
+
 
-unsigned int get_net_connections(NetConnection **connections)
+NetSocketCondition *net_socket_condition_new (int type, NetSocketCondition *left, NetSocketCondition *right)
 {
-	unsigned int nr_connections = 0, nr_processes = 0;
-	GArray *aconnections;
-	GHashTable *open_sockets_hash = NULL;
-	Process *processes = NULL;
-	g_assert(*connections == NULL);
-	*connections = NULL;
+	NetSocketCondition *condition = (NetSocketCondition*)g_malloc0(sizeof(NetSocketCondition));
+	condition->type = type;
+	condition->left = left;
+	condition->right = right;
+	return condition;
+}
+
+void net_socket_condition_free (NetSocketCondition *condition)
+{
+	if (condition != NULL)
+	{
+		net_socket_condition_free(condition->left);
+		net_socket_condition_free(condition->right);
+		g_free(condition);
+	}
+}
+
+void net_socket_filter_free (NetSocketFilter *filter)
+{
+	if (filter != NULL)
+	{
+		net_socket_condition_free(filter->condition);
+		g_free(filter);
+	}
+}
+
+NetSocketCondition *net_socket_condition_copy (const NetSocketCondition *condition)
+{
+	NetSocketCondition *copy = NULL;
+	if (condition != NULL)
+	{
+		copy = (NetSocketCondition*)g_memdup(condition, sizeof(NetSocketCondition));
+		copy->left = net_socket_condition_copy(condition->left);
+		copy->right = net_socket_condition_copy(condition->right);
+	}
+	return copy;
+}
+
+NetSocketFilter *net_socket_filter_copy (const NetSocketFilter *filter)
+{
+	NetSocketFilter *copy = NULL;
+	if (filter != NULL)
+	{
+		copy = (NetSocketFilter*)g_memdup(filter, sizeof(NetSocketFilter));
+		copy->condition = net_socket_condition_copy(filter->condition);
+	}
+	return copy;
+}
+
+static gboolean net_socket_condition_equals (const NetSocketCondition *c1, const NetSocketCondition *c2)
+{
+	if (c1 == NULL || c2 == NULL)
+		return (c1 == c2);
+	return (c1->type == c2->type && 
+	        c1->port_low == c2->port_low && c1->port_high == c2->port_high &&
+	        c1->address.family == c2->address.family && 
+	        memcmp(c1->address.addr, c2->address.addr, sizeof(c1->address.addr)) == 0 &&
+	        c1->prefix_len == c2->prefix_len &&
+	        net_socket_condition_equals(c1->left, c2->left) &&
+	        net_socket_condition_equals(c1->right, c2->right));
+}
+
+gboolean net_socket_filter_equals (const NetSocketFilter *filter1, const NetSocketFilter *filter2)
+{
+	if (filter1 == NULL || filter2 == NULL)
+		return (filter1 == filter2);
+	return (filter1->states == filter2->states && filter1->protocols == filter2->protocols &&
+	        net_socket_condition_equals(filter1->condition, filter2->condition));
+}
+
+void net_collector_needs_free (NetCollectorNeeds *needs)
+{
+	if (needs != NULL)
+	{
+		net_socket_condition_free(needs->sockets.condition);
+		g_free(needs);
+	}
+}
+
+gboolean net_collector_needs_equals (const NetCollectorNeeds *needs1, const NetCollectorNeeds *needs2)
+{
+	if (needs1 == NULL || needs2 == NULL)
+		return (needs1 == needs2);
+	return (needs1->processes == needs2->processes && 
+	        needs1->local_hosts == needs2->local_hosts && needs1->remote_hosts == needs2->remote_hosts && 
+	        net_socket_filter_equals(&(needs1->sockets), &(needs2->sockets)));
+}
+
+
+struct _NetCollector
+{
+	gboolean loaded;
+	guint64 data_hash; /*hash of the socket tables and of the running processes at the last load*/
+	GHashTable *line_cache[NC_PROTOCOLS_NUMBER]; /*ProcNetLine by line key, from the last load*/
+	int diag_fd; /*-1 when the sockets are read from /proc/net*/
+	NetCollectorNeeds needs;
+	GByteArray *diag_bytecode; /*needs condition for sock_diag; NULL for all the sockets*/
+	GTimer *changed_timer; /*since the last changed batch*/
+	/* Set by the steps that reused their cached data for a changed batch: the sockets 
+	 * without a pid and the program names are looked up again after the period, even 
+	 * if the tables stay the same. Read by net_collector_load_sockets. */
+	volatile gint attribution_stale;
+	volatile gint processes_stale;
 	
-	open_sockets_hash = get_open_sockets_for_processes(&processes, &nr_processes);
+	/* Used by net_collector_batch_attribute only */
+	GHashTable *socket_pids; /*pid by socket inode, from the last file descriptors scan*/
+	GTimer *attribution_timer; /*since the last scan; NULL before it*/
+	int attribution_period; /*ms*/
+	/* Used by net_collector_batch_load_processes only */
+	GHashTable *processes_info; /*Process by pid, read since the last period start*/
+	GTimer *processes_timer;
+	int processes_period;
+};
+
+NetCollector *net_collector_new ()
+{
+	NetCollector *collector = (NetCollector*)g_malloc0(sizeof(NetCollector));
+	collector->diag_fd = net_diag_open();
+	net_collector_set_needs(collector, NULL);
+	return collector;
+}
+
+void net_collector_set_needs (NetCollector *collector, NetCollectorNeeds *needs)
+{
+	net_socket_condition_free(collector->needs.sockets.condition);
+	if (needs != NULL)
+	{
+		collector->needs = *needs;
+		g_free(needs);
+	}else
+	{
+		memset(&(collector->needs), 0, sizeof(collector->needs));
+		collector->needs.sockets.states = NSF_ALL_STATES;
+		collector->needs.sockets.protocols = NSF_ALL_PROTOCOLS;
+		collector->needs.processes = TRUE;
+	}
 	
-	aconnections = g_array_sized_new(FALSE, TRUE, sizeof(NetConnection), 16);
-	get_connections_from_kernel(NC_PROTOCOL_TCP, aconnections, open_sockets_hash);
-	get_connections_from_kernel(NC_PROTOCOL_TCP6, aconnections, open_sockets_hash);
-	get_connections_from_kernel(NC_PROTOCOL_UDP, aconnections, open_sockets_hash);
-	get_connections_from_kernel(NC_PROTOCOL_UDP6, aconnections, open_sockets_hash);
+	if (collector->diag_bytecode != NULL)
+		g_byte_array_free(collector->diag_bytecode, TRUE);
+	collector->diag_bytecode = NULL;
+	if (collector->needs.sockets.condition != NULL)
+		collector->diag_bytecode = net_diag_compile_condition(collector->needs.sockets.condition);
+	collector->loaded = FALSE; /*the next load is not compared with the previous one*/
+}
 
-	nr_connections = aconnections->len;
-	*connections = (nr_connections > 0) ? (NetConnection*)aconnections->data : NULL;
-	g_array_free(aconnections, *connections==NULL);
+/* The sock_diag answer of all protocols or NULL, when /proc/net is to be used */
+static GArray *net_collector_get_diag_sockets (NetCollector *collector, const int *load_order)
+{
+	GArray *diag_sockets;
+	guint32 states;
+	int i;
 	
-	free_processes (processes, nr_processes);
-	g_hash_table_destroy(open_sockets_hash);
+	if (collector->diag_fd < 0)
+		return NULL;
 	
-	return nr_connections;	
+	states = collector->needs.sockets.states;
+	diag_sockets = g_array_sized_new(FALSE, FALSE, sizeof(DiagSocket), 64);
+	for (i=0; i<NC_PROTOCOLS_NUMBER; i++)
+	{
+		if ((collector->needs.sockets.protocols & (1 << load_order[i])) == 0)
+			continue;
+		if (!net_diag_get_sockets(collector->diag_fd, load_order[i], states, 
+		                          collector->diag_bytecode, diag_sockets))
+		{
+			if (collector->diag_bytecode != NULL)
+			{
+				/* the kernel may not know some of the conditions; load all the sockets */
+				nactv_trace("sock_diag filter not accepted\n");
+				g_byte_array_free(collector->diag_bytecode, TRUE);
+				collector->diag_bytecode = NULL;
+				g_array_set_size(diag_sockets, 0);
+				i = -1;
+				continue;
+			}
+			nactv_trace("Using /proc/net for the connections list\n");
+			net_diag_close(collector->diag_fd);
+			collector->diag_fd = -1;
+			g_array_free(diag_sockets, TRUE);
+			return NULL;
+		}
+	}
+	return diag_sockets;
+}
+
+void net_collector_free (NetCollector *collector)
+{
+	if (collector != NULL)
+	{
+		int i;
+		for (i=0; i<NC_PROTOCOLS_NUMBER; i++)
+			if (collector->line_cache[i] != NULL)
+				g_hash_table_destroy(collector->line_cache[i]);
+		net_diag_close(collector->diag_fd);
+		net_socket_condition_free(collector->needs.sockets.condition);
+		if (collector->diag_bytecode != NULL)
+			g_byte_array_free(collector->diag_bytecode, TRUE);
+		if (collector->socket_pids != NULL)
+			g_hash_table_destroy(collector->socket_pids);
+		if (collector->changed_timer != NULL)
+			g_timer_destroy(collector->changed_timer);
+		if (collector->attribution_timer != NULL)
+			g_timer_destroy(collector->attribution_timer);
+		if (collector->processes_info != NULL)
+			g_hash_table_destroy(collector->processes_info);
+		if (collector->processes_timer != NULL)
+			g_timer_destroy(collector->processes_timer);
+		g_free(collector);
+	}
+}
+
+void net_collector_set_periods (NetCollector *collector, int attribution_period, int processes_period)
+{
+	collector->attribution_period = MAX(attribution_period, 0);
+	collector->processes_period = MAX(processes_period, 0);
+}
+
+/* A load a little early for the period still counts, so that a period equal to the 
+ * refresh interval does not skip every other refresh */
+static gboolean period_elapsed (GTimer *timer, int period)
+{
+	return (timer == NULL || g_timer_elapsed(timer, NULL) * 1000. >= period * 7. / 8.);
+}
+
+static void restart_period_timer (GTimer **timer)
+{
+	if (*timer == NULL)
+		*timer = g_timer_new();
+	else
+		g_timer_reset(*timer);
+}
+
+static void process_info_free (gpointer data)
+{
+	Process *process = (Process*)data;
+	process_delete_contents(process);
+	g_free(process);
+}
+
+struct _NetCollectorBatch
+{
+	gboolean changed;
+	gboolean force; /*forced or first load with the needs; the periods are not waited*/
+	gboolean processes; /*the connections get their processes*/
+	Process *running_processes;
+	unsigned int nr_running_processes;
+	GArray *connections;
+};
+
+NetCollectorBatch *net_collector_load_sockets (NetCollector *collector, gboolean force)
+{
+	static const int load_order[NC_PROTOCOLS_NUMBER] = { 
+		NC_PROTOCOL_TCP, NC_PROTOCOL_TCP6, NC_PROTOCOL_UDP, NC_PROTOCOL_UDP6 
+	};
+	NetCollectorBatch *batch = (NetCollectorBatch*)g_malloc0(sizeof(NetCollectorBatch));
+	FileReadBuf tables[NC_PROTOCOLS_NUMBER];
+	GArray *diag_sockets;
+	unsigned int i;
+	guint64 data_hash = FNV64_OFFSET_BASIS;
+	
+	/* The running processes and the sockets are read first. The process file 
+	 * descriptors scan, the expensive part, is done only if something changed. 
+	 * A socket moved between processes that keep running is not detected. */
+	batch->processes = collector->needs.processes;
+	if (batch->processes)
+		batch->nr_running_processes = get_running_processes(&(batch->running_processes));
+	for (i=0; i<batch->nr_running_processes; i++)
+		data_hash = hash_fnv1a_64(data_hash, &(batch->running_processes[i].pid), sizeof(long));
+	
+	memset(tables, 0, sizeof(tables));
+	diag_sockets = net_collector_get_diag_sockets(collector, load_order);
+	if (diag_sockets != NULL)
+	{
+		data_hash = hash_fnv1a_64(data_hash, diag_sockets->data, diag_sockets->len * sizeof(DiagSocket));
+	}else
+	{
+		for (i=0; i<NC_PROTOCOLS_NUMBER; i++)
+		{
+			int protocol = load_order[i];
+			if ((collector->needs.sockets.protocols & (1 << protocol)) == 0)
+				continue;
+			tables[protocol] = read_file_ex(protocol_file[protocol], MAX_PROC_NET_FILE_SIZE, 64*1024);
+			data_hash = hash_proc_net_table(data_hash, tables + protocol);
+		}
+	}
+	
+	/* A stale step counts as a change once its period has passed since the last changed 
+	 * batch, so an idle table is attributed again within two periods */
+	batch->changed = (force || !collector->loaded || data_hash != collector->data_hash || 
+	                  (g_atomic_int_get(&(collector->attribution_stale)) && 
+	                   period_elapsed(collector->changed_timer, collector->attribution_period)) || 
+	                  (g_atomic_int_get(&(collector->processes_stale)) && 
+	                   period_elapsed(collector->changed_timer, collector->processes_period)));
+	batch->force = (force || !collector->loaded);
+	if (batch->changed)
+	{
+		restart_period_timer(&(collector->changed_timer));
+		batch->connections = g_array_sized_new(FALSE, TRUE, sizeof(NetConnection), 16);
+		if (diag_sockets != NULL)
+			get_connections_from_diag(diag_sockets, batch->connections);
+		else
+			for (i=0; i<NC_PROTOCOLS_NUMBER; i++)
+				get_connections_from_table(load_order[i], tables + load_order[i], 
+				                           collector->needs.sockets.states, 
+				                           collector->line_cache + load_order[i], 
+				                           batch->connections);
+		
+		collector->loaded = TRUE;
+		collector->data_hash = data_hash;
+	}
+	
+	for (i=0; i<NC_PROTOCOLS_NUMBER; i++)
+		file_readbuf_free_data(tables + i);
+	if (diag_sockets != NULL)
+		g_array_free(diag_sockets, TRUE);
+	
+	return batch;
+}
+
+gboolean net_collector_batch_changed (const NetCollectorBatch *batch)
+{
+	return batch->changed;
+}
+
+/* Between the scans the sockets get the pids of the last scan; new sockets have none yet */
+void net_collector_batch_attribute (NetCollector *collector, NetCollectorBatch *batch)
+{
+	gboolean scanned = FALSE;
+	gboolean stale = FALSE;
+	unsigned int i;
+	
+	if (!batch->changed || !batch->processes)
+		return;
+	
+	if (batch->force || collector->socket_pids == NULL || 
+	    period_elapsed(collector->attribution_timer, collector->attribution_period))
+	{
+		if (collector->socket_pids != NULL)
+			g_hash_table_destroy(collector->socket_pids);
+		collector->socket_pids = get_open_sockets_for_processes(batch->running_processes, 
+		                                                        batch->nr_running_processes);
+		restart_period_timer(&(collector->attribution_timer));
+		scanned = TRUE;
+	}
+	for (i=0; i<batch->connections->len; i++)
+	{
+		NetConnection *conn = &g_array_index(batch->connections, NetConnection, i);
+		set_connection_pid(conn, collector->socket_pids);
+		if (conn->inode != 0 && conn->pid == 0)
+			stale = TRUE;
+	}
+	g_atomic_int_set(&(collector->attribution_stale), (!scanned && stale));
+}
+
+/* The name and command of a pid are read again after the processes period */
+void net_collector_batch_load_processes (NetCollector *collector, NetCollectorBatch *batch)
+{
+	gboolean renewed = FALSE;
+	gboolean stale = FALSE;
+	unsigned int i;
+	
+	if (!batch->changed || !batch->processes)
+		return;
+	
+	if (batch->force || collector->processes_info == NULL || 
+	    period_elapsed(collector->processes_timer, collector->processes_period))
+	{
+		if (collector->processes_info != NULL)
+			g_hash_table_destroy(collector->processes_info);
+		collector->processes_info = g_hash_table_new_full(NULL, NULL, NULL, &process_info_free);
+		restart_period_timer(&(collector->processes_timer));
+		renewed = TRUE;
+	}
+	for (i=0; i<batch->connections->len; i++)
+	{
+		NetConnection *conn = &g_array_index(batch->connections, NetConnection, i);
+		if (conn->pid == 0)
+			continue;
+		if (g_hash_table_lookup(collector->processes_info, GINT_TO_POINTER(conn->pid)) == NULL)
+		{
+			Process *process = g_new0(Process, 1);
+			process->pid = conn->pid;
+			update_process_info(process);
+			g_hash_table_insert(collector->processes_info, GINT_TO_POINTER(process->pid), process);
+		}else
+			stale = !renewed; /*possibly read at an earlier batch*/
+		set_connection_program(conn, collector->processes_info);
+	}
+	g_atomic_int_set(&(collector->processes_stale), stale);
+}
+
+NetConnection *net_collector_batch_take_connections (NetCollectorBatch *batch, unsigned int *nconnections)
+{
+	NetConnection *connections = NULL;
+	*nconnections = 0;
+	if (batch->connections != NULL)
+	{
+		*nconnections = batch->connections->len;
+		connections = (*nconnections > 0) ? (NetConnection*)batch->connections->data : NULL;
+		g_array_free(batch->connections, connections==NULL);
+		batch->connections = NULL;
+	}
+	return connections;
+}
+
+void net_collector_batch_free (NetCollectorBatch *batch)
+{
+	if (batch != NULL)
+	{
+		unsigned int nconnections;
+		NetConnection *connections = net_collector_batch_take_connections(batch, &nconnections);
+		free_net_connections(connections, nconnections);
+		free_processes(batch->running_processes, batch->nr_running_processes);
+		g_free(batch);
+	}
 }
 
 void free_net_connections(NetConnection *connections, unsigned int nconnections)
@@ -418,36 +1045,24 @@ void net_statistics_get (NetStatistics *net_stats)
 	g_strfreev(ifnames);
 }
 
-char *get_port_text (int port)
+const char *get_port_text (int port)
 {
-	char *port_text;
-	if (port > 0)
-		port_text = g_strdup_printf("%d", port);
-	else
-		port_text = g_strdup("*");
-	return port_text;
+	g_assert(port_texts != NULL);
+	if (port > 0 && port < PORTS_NUMBER)
+		return port_texts[port];
+	return "*";
 }
 
-char *get_port_name (int protocol, int port)
+const char *get_port_name (int protocol, int port)
 {
-	const char *service_name = net_service_get(protocol, port);
-	return (service_name != NULL) ? g_strdup(service_name) : NULL;
+	return net_service_get(protocol, port);
 }
 
-char *get_full_port_text(int protocol, int port)
+const char *get_full_port_text(int protocol, int port)
 {
-	char *port_text;
-	if (port > 0)
-	{
-		const char *service_name = net_service_get(protocol, port);
-		if (service_name != NULL)
-			port_text = g_strdup_printf("%d %s", port, service_name);
-		else
-			port_text = g_strdup_printf("%d", port);
-	}
-	else
-		port_text = g_strdup("*");
-	return port_text;
+	if (net_service_get(protocol, port) != NULL)
+		return full_port_texts[service_protocol_index[protocol]][port];
+	return get_port_text(port);
 }
 
 /* - At any moment protocol, addresses and ports are expected to form an unique combination. 
@@ -464,6 +1079,8 @@ char *get_full_port_text(int protocol, int port)
  * well multicast dns (as userspace udp always has inode information). Netactview 0.7 will do 
  * more checks to minimize the number of problematic situations (like verify connection states) 
  * and display a hint in the interface when the matching is unsure. 
+ * - The connections read with sock_diag carry the kernel socket cookie and are matched by it 
+ * (see net_connection_update_list_full); these compares are used for /proc/net only.
  */
 int net_connection_net_equals_exact (NetConnection *nc1, NetConnection *nc2)
 {
@@ -489,13 +1106,20 @@ int net_connection_net_equals_fuzzy (NetConnection *nc1, NetConnection *nc2)
 	       );
 }
 
+/* A missing new string keeps the old one (see net_connection_update) */
+static gboolean optional_string_equals (const char *old_str, const char *new_str)
+{
+	return (new_str == NULL || (old_str != NULL && strcmp(old_str, new_str) == 0));
+}
+
 int net_connection_info_equals (NetConnection *nc1, NetConnection *nc2)
 {
-	/* the connections are already net_equal; protocol, addresses and ports are the same */
+	/* the connections are already net_equal; protocol, addresses and ports are the same. 
+	 * The names are read again after the processes period and may change with the same pid. */
 	return ((nc1->state == nc2->state) && 
-			(nc1->pid == nc2->pid)
-			/* Assuming name and command modify in sync with pid; if not, a rare process name change 
-			 * does not trigger a refresh; the old name should be representative enough */
+			(nc1->pid == nc2->pid) &&
+			optional_string_equals(nc2->programname, nc1->programname) &&
+			optional_string_equals(nc2->programcommand, nc1->programcommand)
 	       );
 }
 
@@ -522,6 +1146,29 @@ void net_connection_update (NetConnection *old_conn, NetConnection *new_conn)
 	if (new_conn->programcommand!=NULL)
 		update_string(&(old_conn->programcommand), new_conn->programcommand);
 	old_conn->inode = new_conn->inode;
+	old_conn->cookie = new_conn->cookie;
+}
+
+static guint cookie_hash (gconstpointer key)
+{
+	guint64 cookie = *(const guint64*)key;
+	return (guint)(cookie ^ (cookie >> 32));
+}
+
+static gboolean cookie_equal (gconstpointer a, gconstpointer b)
+{
+	return *(const guint64*)a == *(const guint64*)b;
+}
+
+static void net_connection_match (NetConnection *new_conn, NetConnection *old_conn)
+{
+	if (!net_connection_info_equals(new_conn, old_conn))
+	{
+		old_conn->operation = NC_OP_UPDATE;
+		net_connection_update(old_conn, new_conn);
+	}else
+		old_conn->operation = NC_OP_NONE;
+	new_conn->operation = NC_OP_DELETE;
 }
 
 void net_connection_update_list_full (GArray *connections, NetConnection *latest_connections, 
@@ -529,10 +1176,23 @@ void net_connection_update_list_full (GArray *connections, NetConnection *latest
 {
 	unsigned int i, j;
 	GArray *valid_connections;
+	GHashTable *cookie_connections;
+	gboolean latest_have_cookies = TRUE;
 	
 	g_assert(connections != NULL && (latest_connections != NULL || nr_latest_connections == 0));
 	
-	valid_connections = g_array_sized_new(FALSE, FALSE, sizeof(NetConnection*), connections->len);
+	for (i=0; i<nr_latest_connections; i++)
+	{
+		latest_connections[i].operation = NC_OP_NONE;
+		if (latest_connections[i].cookie == 0)
+			latest_have_cookies = FALSE;
+	}
+	
+	/* The connections with a cookie are matched by it. The address compare below is needed 
+	 * only for the connections read from /proc/net and, after the collector switched from 
+	 * sock_diag to /proc/net, for all the old connections. */
+	valid_connections = g_array_sized_new(FALSE, FALSE, sizeof(NetConnection*), 16);
+	cookie_connections = g_hash_table_new(&cookie_hash, &cookie_equal);
 	
 	for (i=0; i<connections->len; i++)
 	{
@@ -540,17 +1200,30 @@ void net_connection_update_list_full (GArray *connections, NetConnection *latest
 		if (conn->operation != NC_OP_DELETE)
 		{
 			conn->operation = NC_OP_DELETE; /*DELETE if not found for update*/
-			g_array_append_val(valid_connections, conn);
+			if (conn->cookie != 0)
+				g_hash_table_insert(cookie_connections, &(conn->cookie), conn);
+			if (conn->cookie == 0 || !latest_have_cookies)
+				g_array_append_val(valid_connections, conn);
 		}
 	}
 	
 	for (i=0; i<nr_latest_connections; i++)
-		latest_connections[i].operation = NC_OP_NONE;
+	{
+		NetConnection *new_conn = latest_connections + i, *old_conn;
+		if (new_conn->cookie == 0)
+			continue;
+		old_conn = (NetConnection*)g_hash_table_lookup(cookie_connections, &(new_conn->cookie));
+		if (old_conn != NULL && old_conn->operation == NC_OP_DELETE)
+			net_connection_match(new_conn, old_conn);
+	}
+	g_hash_table_destroy(cookie_connections);
 	
 	/* match first the connections that can be compared exactly */
 	for (i=0; i<nr_latest_connections; i++)
 	{
 		NetConnection *new_conn = latest_connections + i, *old_conn = NULL;
+		if (new_conn->operation == NC_OP_DELETE)
+			continue;
 		
 		for (j=0; j<valid_connections->len; j++)
 		{
@@ -586,15 +1259,7 @@ void net_connection_update_list_full (GArray *connections, NetConnection *latest
 			    break;
 		}
 		if (j < valid_connections->len) /*UPDATE or NONE*/
-		{
-			if (!net_connection_info_equals(new_conn, old_conn))
-			{
-				old_conn->operation = NC_OP_UPDATE;
-				net_connection_update(old_conn, new_conn);
-			}else
-				old_conn->operation = NC_OP_NONE;
-			new_conn->operation = NC_OP_DELETE;
-		}
+			net_connection_match(new_conn, old_conn);
 		else /*INSERT*/
 		{
 			NetConnection *added_conn = net_connection_new();
@@ -608,68 +1273,6 @@ void net_connection_update_list_full (GArray *connections, NetConnection *latest
 }
 
 
-typedef union
-{
-	struct in_addr addr;
-	struct in6_addr addr6;
-}generic_in_addr;
-
-static int generic_in_addr_is_zero (generic_in_addr *addr)
-{
-	return ( (addr->addr6.s6_addr32[0] == 0) && (addr->addr6.s6_addr32[1] == 0) && 
-			(addr->addr6.s6_addr32[2] == 0) && (addr->addr6.s6_addr32[3] == 0) );
-}
-
-char *get_host_name_by_address (const char* saddress)
-{
-	char *host = NULL;
-	
-	if (strlen(saddress) <= 1)
-	{
-		host = NULL;
-	}else
-	{
-		generic_in_addr addr;
-		int address_format;
-		
-		memset(&addr, 0, sizeof(generic_in_addr));
-		address_format = (strchr(saddress, ':')!=NULL) ? AF_INET6 : AF_INET;
-		inet_pton(address_format, saddress, &addr);
-		if (generic_in_addr_is_zero(&addr))
-		{
-			host = NULL;
-		}else
-		{
-			int result, error;
-			const size_t max_buffer_length = 128*1024;
-			size_t buffer_length;
-			struct hostent hostbuffer, *host_info = NULL;
-			char *buffer;
-			
-			buffer_length = 1024;
-			buffer = g_malloc(buffer_length);
-			
-			do
-			{
-				result = gethostbyaddr_r((char*)&addr, sizeof(generic_in_addr), address_format, 
-										 &hostbuffer, buffer, buffer_length, &host_info, &error);
-				if (result == ERANGE)
-				{
-					buffer_length *= 2;
-					buffer = g_realloc(buffer, buffer_length);
-				}
-			}while (result == ERANGE && buffer_length <= max_buffer_length);
-			
-			host = (result == 0 && host_info!=NULL && host_info->h_name!=NULL) ? 
-				g_strdup(host_info->h_name) : NULL;
-			
-			g_free(buffer);
-		}
-	}
-	
-	return host;
-}
-
 static int network_value_compare(unsigned int v1, unsigned int v2)
 {
 	v1 = ntohl(v1);
@@ -57,6 +57,19 @@ enum {
 };
 
 
+enum {
+	NC_HOST_LOCAL = 1,
+	NC_HOST_REMOTE = 2
+};
+
+
+/* Binary address, in network byte order. Only addr[0] is used for AF_INET. */
+typedef struct
+{
+	int family;
+	guint32 addr[4];
+} NetAddress;
+
 typedef struct
 {
 	int protocol;
@@ -66,17 +79,64 @@ typedef struct
 	char *remotehost;
 	char *remoteaddress;
 	int  remoteport;
+	NetAddress localaddr, remoteaddr;
 	int state;
 	long pid; /*current program pid*/
 	long  programpid; /*It does not change to 0*/
 	char *programname;
 	char *programcommand;
 	unsigned long inode;
+	guint64 cookie; /*kernel socket cookie; 0 for connections read from /proc/net*/
 	int operation;
+	int hosts_pending; /*mask of NC_HOST_...: the hosts requested when loaded, not known yet*/
 	void *user_data;
 } NetConnection;
 
 
+/* A condition on the socket addresses and ports. The collector passes it to the kernel 
+ * (sock_diag bytecode) so that only the matching sockets are loaded. */
+typedef struct _NetSocketCondition NetSocketCondition;
+
+enum {
+	NSC_AND,
+	NSC_OR,
+	NSC_NOT,
+	NSC_LOCAL_PORTS,
+	NSC_REMOTE_PORTS,
+	NSC_LOCAL_ADDRESS,
+	NSC_REMOTE_ADDRESS
+};
+
+struct _NetSocketCondition
+{
+	int type;
+	int port_low, port_high; /*ports range*/
+	NetAddress address;
+	int prefix_len; /*address bits compared*/
+	NetSocketCondition *left, *right; /*right is NULL for NSC_NOT*/
+};
+
+/* The sockets of one of the protocols, in one of the states and matching the condition */
+typedef struct
+{
+	NetSocketCondition *condition; /*NULL for all the sockets*/
+	guint32 states; /*mask of 1<<NC_TCP_... state values*/
+	guint protocols; /*mask of 1<<NC_PROTOCOL_... values*/
+} NetSocketFilter;
+
+#define NSF_ALL_STATES 0xFFFFFFFF
+#define NSF_ALL_PROTOCOLS ((1<<NC_PROTOCOLS_NUMBER)-1)
+
+/* What the view can display. The collector loads only these sockets and the processes 
+ * that own them only if processes is TRUE. The hosts are attached by the caller after the load. */
+typedef struct
+{
+	NetSocketFilter sockets;
+	gboolean processes; /*pid, program name and command*/
+	gboolean local_hosts, remote_hosts;
+} NetCollectorNeeds;
+
+
 typedef struct
 {
 	unsigned long long bytes_sent;
@@ -98,6 +158,8 @@ void net_connection_copy (NetConnection *destination, NetConnection *source);
 
 const char *net_connection_get_protocol_name (NetConnection *conn);
 const char *net_connection_get_state_name (NetConnection *conn);
+/* Returns the NC_TCP_... state with the name (case insensitive) or -1 */
+int net_get_state_by_name (const char *name);
 	
 int net_connection_net_equals_exact (NetConnection *nc1, NetConnection *nc2);
 int net_connection_net_equals_fuzzy (NetConnection *nc1, NetConnection *nc2);
@@ -106,20 +168,60 @@ int net_connection_info_equals (NetConnection *nc1, NetConnection *nc2);
 void net_connection_update (NetConnection *old_conn, NetConnection *new_conn);
 
 /* Updates a NetConnection* list by adding the latest connections and setting the 
- * INSERT, UPDATE, DELETE operations*/
+ * INSERT, UPDATE, DELETE operations. Connections with a cookie are matched by it. */
 void net_connection_update_list_full (GArray *connections, NetConnection *latest, 
 									  unsigned int nlatest);
 
-unsigned int get_net_connections (NetConnection **connections);
+NetSocketCondition *net_socket_condition_copy (const NetSocketCondition *condition);
+NetSocketCondition *net_socket_condition_new (int type, NetSocketCondition *left, NetSocketCondition *right);
+void net_socket_condition_free (NetSocketCondition *condition);
+NetSocketFilter *net_socket_filter_copy (const NetSocketFilter *filter);
+void net_socket_filter_free (NetSocketFilter *filter);
+gboolean net_socket_filter_equals (const NetSocketFilter *filter1, const NetSocketFilter *filter2);
+void net_collector_needs_free (NetCollectorNeeds *needs);
+gboolean net_collector_needs_equals (const NetCollectorNeeds *needs1, const NetCollectorNeeds *needs2);
+
+/* Loads the connections and remembers the data they were built from between loads */
+typedef struct _NetCollector NetCollector;
+
+NetCollector *net_collector_new ();
+void net_collector_free (NetCollector *collector);
+/* Takes ownership of needs (NULL loads everything). The condition is only a hint: 
+ * it is not checked when the kernel can't do it (/proc/net). */
+void net_collector_set_needs (NetCollector *collector, NetCollectorNeeds *needs);
+/* The process file descriptors are scanned at most once per attribution_period and the 
+ * name and command of a process are read once per processes_period (ms; 0 for every load). 
+ * Forced loads do both. A socket left without a pid, or a name that may be out of date, 
+ * makes a later load count as changed once its period has passed. 
+ * Called before the loading starts. */
+void net_collector_set_periods (NetCollector *collector, int attribution_period, int processes_period);
+
+/* A load is made in steps, which the caller may run on different threads: 
+ * the sockets are loaded by net_collector_load_sockets and the batch then goes through 
+ * net_collector_batch_attribute (the process file descriptors scan) and 
+ * net_collector_batch_load_processes (the name and command of the owners), in this order. 
+ * Each step uses its own part of the collector: the steps of consecutive batches may run 
+ * at the same time, each step on a single thread. */
+typedef struct _NetCollectorBatch NetCollectorBatch;
+
+NetCollectorBatch *net_collector_load_sockets (NetCollector *collector, gboolean force);
+/* FALSE if the socket tables and the running processes are the same as at the previous 
+ * load; the batch has no connections then. A forced load is always changed. */
+gboolean net_collector_batch_changed (const NetCollectorBatch *batch);
+void net_collector_batch_attribute (NetCollector *collector, NetCollectorBatch *batch);
+void net_collector_batch_load_processes (NetCollector *collector, NetCollectorBatch *batch);
+NetConnection *net_collector_batch_take_connections (NetCollectorBatch *batch, unsigned int *nconnections);
+void net_collector_batch_free (NetCollectorBatch *batch);
+
 void free_net_connections (NetConnection *connections, unsigned int nconnections);
 void free_net_connections_array (GArray *connections);
 
 void net_statistics_get (NetStatistics *net_stats);
 
-char *get_port_text (int port);
-char *get_port_name (int protocol, int port);
-char *get_full_port_text(int protocol, int port);
-char *get_host_name_by_address (const char* address);
+/* The port texts and names are shared; get_port_name returns NULL for the unknown services */
+const char *get_port_text (int port);
+const char *get_port_name (int protocol, int port);
+const char *get_full_port_text(int protocol, int port);
 int compare_addresses(const char *addr1, const char *addr2);
 int compare_hosts(const char *addr1, const char *addr2);
 
@@ -0,0 +1,285 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#include "nactv-debug.h"
+#include "netdiag.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <glib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+
+#define NET_DIAG_RECEIVE_BUFFER_SIZE (32*1024)
+
+
+int net_diag_open ()
+{
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+	if (fd < 0)
+		nactv_trace("sock_diag socket error %d\n", errno);
+	return fd;
+}
+
+void net_diag_close (int fd)
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+static gboolean net_diag_send_request (int fd, int protocol, guint32 sequence, guint32 states, 
+                                       const GByteArray *bytecode)
+{
+	struct
+	{
+		struct nlmsghdr header;
+		struct inet_diag_req_v2 request;
+	} message;
+	struct rtattr bytecode_attribute;
+	struct sockaddr_nl kernel_address;
+	struct iovec parts[3];
+	struct msghdr msg;
+	ssize_t sent, length;
+	
+	memset(&kernel_address, 0, sizeof(kernel_address));
+	kernel_address.nl_family = AF_NETLINK;
+	
+	memset(&message, 0, sizeof(message));
+	message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	message.header.nlmsg_seq = sequence;
+	message.request.sdiag_family =
+		(protocol == NC_PROTOCOL_TCP6 || protocol == NC_PROTOCOL_UDP6) ? AF_INET6 : AF_INET;
+	message.request.sdiag_protocol =
+		(protocol == NC_PROTOCOL_TCP || protocol == NC_PROTOCOL_TCP6) ? IPPROTO_TCP : IPPROTO_UDP;
+	message.request.idiag_states = states;
+	
+	parts[0].iov_base = &message;
+	parts[0].iov_len = sizeof(message);
+	length = sizeof(message);
+	if (bytecode != NULL)
+	{
+		/* the bytecode length is a multiple of 4; no attribute padding needed */
+		bytecode_attribute.rta_type = INET_DIAG_REQ_BYTECODE;
+		bytecode_attribute.rta_len = RTA_LENGTH(bytecode->len);
+		parts[1].iov_base = &bytecode_attribute;
+		parts[1].iov_len = sizeof(bytecode_attribute);
+		parts[2].iov_base = bytecode->data;
+		parts[2].iov_len = bytecode->len;
+		length += RTA_LENGTH(bytecode->len);
+	}
+	message.header.nlmsg_len = length;
+	
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &kernel_address;
+	msg.msg_namelen = sizeof(kernel_address);
+	msg.msg_iov = parts;
+	msg.msg_iovlen = (bytecode != NULL) ? 3 : 1;
+	
+	do
+	{
+		sent = sendmsg(fd, &msg, 0);
+	}while (sent < 0 && errno == EINTR);
+	
+	return (sent == length);
+}
+
+static void net_diag_append_socket (int protocol, const struct inet_diag_msg *msg, GArray *sockets)
+{
+	DiagSocket socket;
+	
+	memset(&socket, 0, sizeof(socket)); /*the padding is hashed too*/
+	socket.protocol = protocol;
+	socket.family = msg->idiag_family;
+	if (msg->idiag_family == AF_INET6)
+	{
+		memcpy(socket.localaddr, msg->id.idiag_src, sizeof(socket.localaddr));
+		memcpy(socket.remoteaddr, msg->id.idiag_dst, sizeof(socket.remoteaddr));
+	}else
+	{
+		socket.localaddr[0] = msg->id.idiag_src[0];
+		socket.remoteaddr[0] = msg->id.idiag_dst[0];
+	}
+	socket.localport = ntohs(msg->id.idiag_sport);
+	socket.remoteport = ntohs(msg->id.idiag_dport);
+	socket.state = msg->idiag_state;
+	socket.inode = msg->idiag_inode;
+	socket.cookie = ((guint64)msg->id.idiag_cookie[1] << 32) | msg->id.idiag_cookie[0];
+	
+	g_array_append_val(sockets, socket);
+}
+
+gboolean net_diag_get_sockets (int fd, int protocol, guint32 states, const GByteArray *bytecode, 
+                               GArray *sockets)
+{
+	static guint32 sequence = 0;
+	long buffer[NET_DIAG_RECEIVE_BUFFER_SIZE / sizeof(long)]; /*aligned for nlmsghdr*/
+	
+	g_assert(protocol>=0 && protocol<NC_PROTOCOLS_NUMBER);
+	if (fd < 0)
+		return FALSE;
+	
+	sequence++;
+	if (!net_diag_send_request(fd, protocol, sequence, states, bytecode))
+	{
+		nactv_trace("sock_diag request error %d\n", errno);
+		return FALSE;
+	}
+	
+	while (TRUE)
+	{
+		struct nlmsghdr *header;
+		ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+		int length;
+	
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0)
+		{
+			nactv_trace("sock_diag receive error %d\n", errno);
+			return FALSE;
+		}
+	
+		length = (int)received;
+		for (header = (struct nlmsghdr*)buffer; NLMSG_OK(header, length);
+		     header = NLMSG_NEXT(header, length))
+		{
+			if (header->nlmsg_seq != sequence)
+				continue; /*from an abandoned request*/
+			if (header->nlmsg_type == NLMSG_DONE)
+				return TRUE;
+			if (header->nlmsg_type == NLMSG_ERROR)
+			{
+				nactv_trace("sock_diag not supported for protocol %d\n", protocol);
+				return FALSE;
+			}
+			if (header->nlmsg_type == SOCK_DIAG_BY_FAMILY &&
+			    header->nlmsg_len >= NLMSG_LENGTH(sizeof(struct inet_diag_msg)))
+				net_diag_append_socket(protocol, (struct inet_diag_msg*)NLMSG_DATA(header), sockets);
+		}
+	}
+}
+
+
+/* The bytecode is run by the kernel for each socket: an operation jumps "yes" bytes ahead 
+ * if its condition is true and "no" bytes otherwise. The socket is accepted if the program 
+ * ends exactly at its end. Each compiled part rejects by jumping 4 bytes past its end; 
+ * the AND and OR combinations relocate these jumps (the layout used by iproute2 ss). */
+
+static void bytecode_append_op (GByteArray *bytecode, int code, int yes, int no)
+{
+	struct inet_diag_bc_op op;
+	op.code = code;
+	op.yes = yes;
+	op.no = no;
+	g_byte_array_append(bytecode, (const guint8*)&op, sizeof(op));
+}
+
+/* Moves the rejecting jumps of the first len bytes to the end of the next reloc bytes */
+static void bytecode_relocate_rejects (GByteArray *bytecode, int start, int len, int reloc)
+{
+	while (len > 0)
+	{
+		struct inet_diag_bc_op *op = (struct inet_diag_bc_op*)(bytecode->data + start);
+		if (op->no == len + 4)
+			op->no += reloc;
+		len -= op->yes;
+		start += op->yes;
+	}
+	g_assert(len == 0);
+}
+
+static void bytecode_append_ports (GByteArray *bytecode, gboolean local, int low, int high)
+{
+	/* port >= low and port <= high; the port is in the "no" field of the second op */
+	bytecode_append_op(bytecode, local ? INET_DIAG_BC_S_GE : INET_DIAG_BC_D_GE, 8, 20);
+	bytecode_append_op(bytecode, 0, 0, low);
+	bytecode_append_op(bytecode, local ? INET_DIAG_BC_S_LE : INET_DIAG_BC_D_LE, 8, 12);
+	bytecode_append_op(bytecode, 0, 0, high);
+}
+
+static void bytecode_append_address (GByteArray *bytecode, gboolean local, 
+                                     const NetAddress *address, int prefix_len)
+{
+	struct inet_diag_hostcond condition;
+	int address_len = (address->family == AF_INET6) ? 16 : 4;
+	int len = sizeof(struct inet_diag_bc_op) + sizeof(condition) + address_len;
+	
+	bytecode_append_op(bytecode, local ? INET_DIAG_BC_S_COND : INET_DIAG_BC_D_COND, len, len + 4);
+	memset(&condition, 0, sizeof(condition));
+	condition.family = address->family;
+	condition.prefix_len = prefix_len;
+	condition.port = -1;
+	g_byte_array_append(bytecode, (const guint8*)&condition, sizeof(condition));
+	g_byte_array_append(bytecode, (const guint8*)address->addr, address_len);
+}
+
+static void bytecode_append_condition (GByteArray *bytecode, const NetSocketCondition *condition)
+{
+	unsigned int start = bytecode->len, left_len;
+	
+	switch (condition->type)
+	{
+	case NSC_AND:
+		bytecode_append_condition(bytecode, condition->left);
+		left_len = bytecode->len - start;
+		bytecode_append_condition(bytecode, condition->right);
+		bytecode_relocate_rejects(bytecode, start, left_len, bytecode->len - start - left_len);
+		break;
+	case NSC_OR:
+		/* left rejects to right; left accepts by jumping over right */
+		bytecode_append_condition(bytecode, condition->left);
+		left_len = bytecode->len - start;
+		bytecode_append_op(bytecode, INET_DIAG_BC_JMP, 4, 0);
+		bytecode_append_condition(bytecode, condition->right);
+		((struct inet_diag_bc_op*)(bytecode->data + start + left_len))->no = 
+			bytecode->len - start - left_len;
+		break;
+	case NSC_NOT:
+		bytecode_append_condition(bytecode, condition->left);
+		bytecode_append_op(bytecode, INET_DIAG_BC_JMP, 4, 8);
+		break;
+	case NSC_LOCAL_PORTS:
+	case NSC_REMOTE_PORTS:
+		bytecode_append_ports(bytecode, condition->type == NSC_LOCAL_PORTS, 
+		                      condition->port_low, condition->port_high);
+		break;
+	case NSC_LOCAL_ADDRESS:
+	case NSC_REMOTE_ADDRESS:
+		bytecode_append_address(bytecode, condition->type == NSC_LOCAL_ADDRESS, 
+		                        &(condition->address), condition->prefix_len);
+		break;
+	default:
+		g_assert(0);
+	}
+}
+
+GByteArray *net_diag_compile_condition (const NetSocketCondition *condition)
+{
+	GByteArray *bytecode = g_byte_array_new();
+	g_assert(condition != NULL);
+	bytecode_append_condition(bytecode, condition);
+	return bytecode;
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#ifndef NACTV_NETDIAG_H
+#define NACTV_NETDIAG_H
+
+#include "net.h"
+#include <glib.h>
+
+/* A socket as reported by the kernel sock_diag netlink interface.
+ * Addresses are in network byte order. */
+typedef struct
+{
+	int protocol; /*NC_PROTOCOL_...*/
+	int family; /*AF_INET or AF_INET6*/
+	guint32 localaddr[4];
+	guint32 remoteaddr[4];
+	int localport;
+	int remoteport;
+	int state;
+	unsigned long inode;
+	guint64 cookie; /*unique for the socket lifetime; never 0*/
+} DiagSocket;
+
+
+/* Returns -1 if the sock_diag interface is not available */
+int net_diag_open ();
+void net_diag_close (int fd);
+
+/* Appends the sockets of protocol (NC_PROTOCOL_...) in one of the states (mask of 1<<NC_TCP_...) 
+ * and accepted by bytecode (may be NULL) to sockets (a DiagSocket array).
+ * Returns FALSE if the kernel did not answer the request; sockets may hold part of the answer. */
+gboolean net_diag_get_sockets (int fd, int protocol, guint32 states, const GByteArray *bytecode, 
+                               GArray *sockets);
+
+/* Returns the INET_DIAG_REQ_BYTECODE program that accepts the sockets matching condition */
+GByteArray *net_diag_compile_condition (const NetSocketCondition *condition);
+
+
+#endif /*NACTV_NETDIAG_H*/
@@ -0,0 +1,275 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#include "nactv-debug.h"
+#include "prefixtrie.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+#define PREFIX_FILE_MAX_SIZE (64*1024*1024)
+
+/* The bits of a key are the address bytes in network order, most significant bit first */
+#define KEY_BIT(key, i) (((key)[(i) >> 3] >> (7 - ((i) & 7))) & 1)
+
+typedef struct _PrefixNode PrefixNode;
+
+/* A node holds the prefix of all its descendants. The nodes without value only branch. */
+struct _PrefixNode
+{
+	guint8 key[16]; /*the bits past len are 0*/
+	int len;
+	gpointer value;
+	PrefixNode *child[2];
+};
+
+struct _PrefixTrie
+{
+	volatile gint ref_count;
+	PrefixNode *root[2]; /*IPv4 and IPv6*/
+	unsigned int size;
+};
+
+
+PrefixTrie *prefix_trie_new ()
+{
+	PrefixTrie *trie = (PrefixTrie*)g_malloc0(sizeof(PrefixTrie));
+	trie->ref_count = 1;
+	return trie;
+}
+
+PrefixTrie *prefix_trie_ref (PrefixTrie *trie)
+{
+	g_atomic_int_inc(&trie->ref_count);
+	return trie;
+}
+
+static void prefix_node_free (PrefixNode *node)
+{
+	if (node != NULL)
+	{
+		prefix_node_free(node->child[0]);
+		prefix_node_free(node->child[1]);
+		g_free(node);
+	}
+}
+
+void prefix_trie_unref (PrefixTrie *trie)
+{
+	if (trie != NULL && g_atomic_int_dec_and_test(&trie->ref_count))
+	{
+		prefix_node_free(trie->root[0]);
+		prefix_node_free(trie->root[1]);
+		g_free(trie);
+	}
+}
+
+unsigned int prefix_trie_size (const PrefixTrie *trie)
+{
+	return trie->size;
+}
+
+/* Returns the number of equal leading bits, up to len */
+static int key_common_bits (const guint8 *key1, const guint8 *key2, int len)
+{
+	int i;
+	for (i=0; i < len; i += 8)
+	{
+		guint8 diff = key1[i >> 3] ^ key2[i >> 3];
+		if (diff != 0)
+		{
+			while (!(diff & 0x80))
+			{
+				diff <<= 1;
+				i++;
+			}
+			return MIN(i, len);
+		}
+	}
+	return len;
+}
+
+static gboolean key_prefix_equal (const guint8 *key, const guint8 *prefix, int len)
+{
+	int full_bytes = len >> 3, rest_bits = len & 7;
+	if (memcmp(key, prefix, full_bytes) != 0)
+		return FALSE;
+	return (rest_bits == 0 || 
+	        ((key[full_bytes] ^ prefix[full_bytes]) & (guint8)(0xFF << (8 - rest_bits))) == 0);
+}
+
+static PrefixNode *prefix_node_new (const guint8 *key, int len, gpointer value)
+{
+	PrefixNode *node = (PrefixNode*)g_malloc0(sizeof(PrefixNode));
+	memcpy(node->key, key, (len + 7) >> 3);
+	if (len & 7)
+		node->key[len >> 3] &= (guint8)(0xFF << (8 - (len & 7)));
+	node->len = len;
+	node->value = value;
+	return node;
+}
+
+void prefix_trie_add (PrefixTrie *trie, const NetAddress *address, int prefix_len, gpointer value)
+{
+	const guint8 *key = (const guint8*)address->addr;
+	PrefixNode **slot = &trie->root[address->family == AF_INET6];
+	
+	g_assert(value != NULL);
+	g_assert(prefix_len >= 0 && prefix_len <= ((address->family == AF_INET6) ? 128 : 32));
+	
+	while (TRUE)
+	{
+		PrefixNode *node = *slot, *added;
+		int common;
+		
+		if (node == NULL)
+		{
+			*slot = prefix_node_new(key, prefix_len, value);
+			break;
+		}
+		common = key_common_bits(node->key, key, MIN(node->len, prefix_len));
+		if (common == node->len)
+		{
+			if (prefix_len == node->len)
+			{
+				if (node->value == NULL)
+					trie->size++;
+				node->value = value;
+				return;
+			}
+			slot = &node->child[KEY_BIT(key, node->len)];
+			continue;
+		}
+		
+		/* the prefix diverges inside the node prefix or ends inside it */
+		if (common == prefix_len)
+			added = prefix_node_new(key, prefix_len, value);
+		else
+		{
+			added = prefix_node_new(key, common, NULL);
+			added->child[KEY_BIT(key, common)] = prefix_node_new(key, prefix_len, value);
+		}
+		added->child[KEY_BIT(node->key, common)] = node;
+		*slot = added;
+		break;
+	}
+	trie->size++;
+}
+
+/* Sets *len to the length of the matched prefix */
+static gpointer prefix_node_lookup (const PrefixNode *node, const guint8 *key, int key_len, int *len)
+{
+	gpointer value = NULL;
+	while (node != NULL && key_prefix_equal(key, node->key, node->len))
+	{
+		if (node->value != NULL)
+		{
+			value = node->value;
+			*len = node->len;
+		}
+		if (node->len == key_len)
+			break;
+		node = node->child[KEY_BIT(key, node->len)];
+	}
+	return value;
+}
+
+gpointer prefix_trie_lookup (const PrefixTrie *trie, const NetAddress *address)
+{
+	gpointer value, value4;
+	int len = 0, len4 = 0;
+	
+	if (address->family != AF_INET6)
+		return prefix_node_lookup(trie->root[0], (const guint8*)address->addr, 32, &len);
+	
+	value = prefix_node_lookup(trie->root[1], (const guint8*)address->addr, 128, &len);
+	if (address->addr[0] == 0 && address->addr[1] == 0 && address->addr[2] == htonl(0xFFFF))
+	{
+		/* the IPv4 prefixes are 96 bits longer as IPv6 prefixes */
+		value4 = prefix_node_lookup(trie->root[0], (const guint8*)(address->addr + 3), 32, &len4);
+		if (value4 != NULL && (value == NULL || len4 + 96 >= len))
+			value = value4;
+	}
+	return value;
+}
+
+gboolean net_address_parse_prefix (const char *text, NetAddress *address, int *prefix_len)
+{
+	char *address_text = g_strdup(text);
+	char *prefix_text = strchr(address_text, '/');
+	int max_prefix_len, parsed;
+	
+	if (prefix_text != NULL)
+		*(prefix_text++) = '\0';
+	memset(address, 0, sizeof(NetAddress));
+	address->family = (strchr(address_text, ':') != NULL) ? AF_INET6 : AF_INET;
+	max_prefix_len = (address->family == AF_INET6) ? 128 : 32;
+	parsed = (inet_pton(address->family, address_text, address->addr) == 1);
+	*prefix_len = max_prefix_len;
+	if (parsed && prefix_text != NULL)
+	{
+		char *end = NULL;
+		long len = strtol(prefix_text, &end, 10);
+		parsed = (*prefix_text >= '0' && *prefix_text <= '9' && *end == '\0' && len <= max_prefix_len);
+		*prefix_len = (int)len;
+	}
+	g_free(address_text);
+	return parsed;
+}
+
+gboolean prefix_trie_add_file (PrefixTrie *trie, const char *path, const char *default_value)
+{
+	FileReadBuf read_buf = read_file_ex(path, PREFIX_FILE_MAX_SIZE, 4096);
+	char **lines;
+	int i;
+	
+	if (!read_buf.isComplete)
+	{
+		nactv_trace("prefix list %s can't be read\n", path);
+		file_readbuf_free_data(&read_buf);
+		return FALSE;
+	}
+	
+	lines = g_strsplit(read_buf.data, "\n", -1);
+	for (i=0; lines[i] != NULL; i++)
+	{
+		char **fields = g_strsplit_set(g_strstrip(lines[i]), " \t", 2);
+		NetAddress address;
+		int prefix_len;
+		
+		if (fields[0] != NULL && fields[0][0] != '\0' && fields[0][0] != '#')
+		{
+			if (net_address_parse_prefix(fields[0], &address, &prefix_len))
+			{
+				const char *value = (fields[1] != NULL) ? g_strstrip(fields[1]) : "";
+				prefix_trie_add(trie, &address, prefix_len, 
+				                (gpointer)g_intern_string((*value != '\0') ? value : default_value));
+			}else
+				nactv_trace("prefix list %s line %d skipped\n", path, i + 1);
+		}
+		g_strfreev(fields);
+	}
+	g_strfreev(lines);
+	file_readbuf_free_data(&read_buf);
+	return TRUE;
+}
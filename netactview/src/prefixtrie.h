@@ -0,0 +1,50 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#ifndef NACTV_PREFIXTRIE_H
+#define NACTV_PREFIXTRIE_H
+
+#include "net.h"
+#include <glib.h>
+
+/* A set of IPv4 and IPv6 address prefixes with a value each: a compressed radix trie 
+ * looked up in at most prefix length steps, whatever the number of prefixes. 
+ * The lookups are read only and can be made by many threads. */
+typedef struct _PrefixTrie PrefixTrie;
+
+PrefixTrie *prefix_trie_new ();
+PrefixTrie *prefix_trie_ref (PrefixTrie *trie);
+void prefix_trie_unref (PrefixTrie *trie);
+
+/* value can't be NULL; the value of a prefix added again is replaced */
+void prefix_trie_add (PrefixTrie *trie, const NetAddress *address, int prefix_len, gpointer value);
+/* Returns the value of the longest prefix containing address or NULL. The IPv4 mapped 
+ * IPv6 addresses are also looked up as IPv4 addresses, like the filter address terms. */
+gpointer prefix_trie_lookup (const PrefixTrie *trie, const NetAddress *address);
+unsigned int prefix_trie_size (const PrefixTrie *trie);
+
+/* Adds the prefixes of a list file: a prefix per line, optionally followed by a value text; 
+ * the lines without value get default_value. The values are interned strings. Empty lines 
+ * and the ones starting with '#' are skipped; the other lines that can't be parsed are 
+ * traced and skipped. Returns FALSE if the file can't be read. */
+gboolean prefix_trie_add_file (PrefixTrie *trie, const char *path, const char *default_value);
+
+/* Parses "address[/prefix_len]"; without prefix_len the whole address is compared */
+gboolean net_address_parse_prefix (const char *text, NetAddress *address, int *prefix_len);
+
+
+#endif /*NACTV_PREFIXTRIE_H*/
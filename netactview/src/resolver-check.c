@@ -0,0 +1,320 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/* Runs the resolver against a stub nameserver on 127.0.0.1, given to the resolver as
+ * its only nameserver (address#port). The stub answers each address in its own way:
+ * a name, no name, a server failure, a truncated answer, an answer with the wrong id
+ * or question, or nothing. Exits with 1 if a result or a retry is not the expected one. */
+
+#include "nactv-debug.h"
+#include "resolver.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <glib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define STUB_TIMEOUT_MS 200
+#define STUB_ATTEMPTS 2
+#define CHECK_WAIT_MS 5000
+
+#define DNS_HEADER_SIZE 12
+#define DNS_RCODE_NAME_ERROR 3
+#define DNS_RCODE_SERVER_FAILURE 2
+
+enum { ANSWER_NAME, ANSWER_NO_NAME, ANSWER_FAILURE, ANSWER_TRUNCATED_FIRST,
+       ANSWER_WRONG_ID_FIRST, ANSWER_WRONG_QUESTION_FIRST, ANSWER_NONE };
+
+typedef struct
+{
+	const char *address;
+	const char *qname; /*the PTR question name*/
+	int answer;
+	const char *host; /*answered, when the answer has a name*/
+	int status; /*expected*/
+	unsigned int queries; /*expected, the tries*/
+	unsigned int received; /*by the stub*/
+	int ports[STUB_ATTEMPTS]; /*of the tries*/
+	int answered; /*callbacks*/
+	char *answered_host;
+	int answered_status;
+} CheckCase;
+
+static CheckCase cases[] =
+{
+	{ "10.0.0.1", "1.0.0.10.in-addr.arpa", ANSWER_NAME, "one.example", RESOLVER_FOUND, 1 },
+	{ "10.0.0.2", "2.0.0.10.in-addr.arpa", ANSWER_NO_NAME, NULL, RESOLVER_NOT_FOUND, 1 },
+	{ "10.0.0.3", "3.0.0.10.in-addr.arpa", ANSWER_FAILURE, NULL, RESOLVER_FAILED, STUB_ATTEMPTS },
+	{ "10.0.0.4", "4.0.0.10.in-addr.arpa", ANSWER_TRUNCATED_FIRST, "four.example", RESOLVER_FOUND, 2 },
+	{ "10.0.0.5", "5.0.0.10.in-addr.arpa", ANSWER_WRONG_ID_FIRST, "five.example", RESOLVER_FOUND, 1 },
+	{ "10.0.0.6", "6.0.0.10.in-addr.arpa", ANSWER_WRONG_QUESTION_FIRST, "six.example", RESOLVER_FOUND, 1 },
+	{ "10.0.0.7", "7.0.0.10.in-addr.arpa", ANSWER_NONE, NULL, RESOLVER_FAILED, STUB_ATTEMPTS },
+	{ "2001:db8::1", "1.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa",
+	  ANSWER_NAME, "six.example", RESOLVER_FOUND, 1 }
+};
+
+static GMutex *cases_lock;
+static volatile gboolean stub_stop;
+
+static CheckCase *find_case (const char *qname)
+{
+	unsigned int i;
+	for (i=0; i<G_N_ELEMENTS(cases); i++)
+	{
+		if (g_ascii_strcasecmp(cases[i].qname, qname) == 0)
+			return &cases[i];
+	}
+	return NULL;
+}
+
+/* Reads the question name; returns the question size with type and class or -1 */
+static int read_question (const guint8 *packet, int len, char *qname, int qname_size)
+{
+	int offset = DNS_HEADER_SIZE, qlen = 0;
+	while (offset < len && packet[offset] != 0)
+	{
+		int label_len = packet[offset];
+		if (label_len > 63 || offset + 1 + label_len >= len || qlen + label_len + 2 > qname_size)
+			return -1;
+		if (qlen > 0)
+			qname[qlen++] = '.';
+		memcpy(qname + qlen, packet + offset + 1, label_len);
+		qlen += label_len;
+		offset += 1 + label_len;
+	}
+	qname[qlen] = '\0';
+	if (offset + 5 > len)
+		return -1;
+	return offset + 5 - DNS_HEADER_SIZE;
+}
+
+static int append_name (guint8 *packet, int len, const char *name)
+{
+	gchar **labels = g_strsplit(name, ".", -1);
+	int i;
+	for (i=0; labels[i] != NULL; i++)
+	{
+		int label_len = strlen(labels[i]);
+		packet[len++] = (guint8)label_len;
+		memcpy(packet + len, labels[i], label_len);
+		len += label_len;
+	}
+	packet[len++] = 0;
+	g_strfreev(labels);
+	return len;
+}
+
+/* The answer to query with the question copied: rcode, the TC flag and a PTR record to host */
+static int make_answer (guint8 *packet, const guint8 *query, int question_len,
+                        int rcode, gboolean truncated, const char *host)
+{
+	int len = DNS_HEADER_SIZE + question_len, rdata;
+
+	memcpy(packet, query, len);
+	packet[2] = 0x80 | (query[2] & 0x01) | (truncated ? 0x02 : 0);
+	packet[3] = 0x80 | rcode;
+	packet[6] = 0;
+	packet[7] = (host != NULL) ? 1 : 0;
+	packet[8] = packet[9] = packet[10] = packet[11] = 0;
+	if (host != NULL)
+	{
+		static const guint8 record[] = { 0xc0, DNS_HEADER_SIZE, 0, 12, 0, 1, 0, 0, 1, 0x2c };
+		memcpy(packet + len, record, sizeof(record));
+		len += sizeof(record);
+		rdata = len + 2;
+		len = append_name(packet, rdata, host);
+		packet[rdata - 2] = (guint8)((len - rdata) >> 8);
+		packet[rdata - 1] = (guint8)(len - rdata);
+	}
+	return len;
+}
+
+static void stub_answer (int fd, const guint8 *query, int query_len,
+                         const struct sockaddr_in *from)
+{
+	guint8 packet[512];
+	char qname[256];
+	int question_len = read_question(query, query_len, qname, sizeof(qname));
+	int len = 0;
+	unsigned int received;
+	CheckCase *check;
+
+	if (question_len < 0 || (check = find_case(qname)) == NULL)
+		return;
+	g_mutex_lock(cases_lock);
+	received = check->received++;
+	if (received < STUB_ATTEMPTS)
+		check->ports[received] = ntohs(from->sin_port);
+	g_mutex_unlock(cases_lock);
+
+	switch (check->answer)
+	{
+	case ANSWER_NAME:
+		len = make_answer(packet, query, question_len, 0, FALSE, check->host);
+		break;
+	case ANSWER_NO_NAME:
+		len = make_answer(packet, query, question_len, DNS_RCODE_NAME_ERROR, FALSE, NULL);
+		break;
+	case ANSWER_FAILURE:
+		len = make_answer(packet, query, question_len, DNS_RCODE_SERVER_FAILURE, FALSE, NULL);
+		break;
+	case ANSWER_TRUNCATED_FIRST:
+		len = make_answer(packet, query, question_len, 0, (received == 0),
+		                  (received == 0) ? NULL : check->host);
+		break;
+	case ANSWER_WRONG_ID_FIRST:
+	case ANSWER_WRONG_QUESTION_FIRST:
+		/* a spoofed answer with another name arrives first and is to be dropped */
+		len = make_answer(packet, query, question_len, 0, FALSE, "spoofed.example");
+		if (check->answer == ANSWER_WRONG_ID_FIRST)
+			packet[1] ^= 0xff;
+		else
+			packet[DNS_HEADER_SIZE + 1] = '9';
+		sendto(fd, packet, len, 0, (const struct sockaddr*)from, sizeof(*from));
+		len = make_answer(packet, query, question_len, 0, FALSE, check->host);
+		break;
+	case ANSWER_NONE:
+		break;
+	}
+	if (len > 0)
+		sendto(fd, packet, len, 0, (const struct sockaddr*)from, sizeof(*from));
+}
+
+static gpointer stub_thread_func (gpointer data)
+{
+	int fd = GPOINTER_TO_INT(data);
+
+	while (!stub_stop)
+	{
+		struct pollfd pfd;
+		guint8 query[512];
+		struct sockaddr_in from;
+		socklen_t from_len = sizeof(from);
+		ssize_t received;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 50) <= 0)
+			continue;
+		received = recvfrom(fd, query, sizeof(query), 0, (struct sockaddr*)&from, &from_len);
+		if (received > DNS_HEADER_SIZE)
+			stub_answer(fd, query, (int)received, &from);
+	}
+	return NULL;
+}
+
+static void resolved (const char *address, const char *host, int status, gpointer user_data)
+{
+	unsigned int i;
+	g_mutex_lock(cases_lock);
+	for (i=0; i<G_N_ELEMENTS(cases); i++)
+	{
+		if (strcmp(cases[i].address, address) == 0)
+		{
+			cases[i].answered++;
+			cases[i].answered_status = status;
+			g_free(cases[i].answered_host);
+			cases[i].answered_host = g_strdup(host);
+		}
+	}
+	g_mutex_unlock(cases_lock);
+}
+
+static gboolean all_answered ()
+{
+	gboolean answered = TRUE;
+	unsigned int i;
+	g_mutex_lock(cases_lock);
+	for (i=0; i<G_N_ELEMENTS(cases); i++)
+		answered = answered && (cases[i].answered > 0);
+	g_mutex_unlock(cases_lock);
+	return answered;
+}
+
+static int check_case (const CheckCase *check)
+{
+	int failed = (check->answered != 1 || check->answered_status != check->status ||
+	              check->received != check->queries ||
+	              (check->host != NULL) != (check->answered_host != NULL) ||
+	              (check->host != NULL && strcmp(check->host, check->answered_host) != 0));
+	/* each try is sent from its own socket */
+	if (check->received >= 2 && check->ports[0] == check->ports[1])
+		failed = TRUE;
+	printf("%-12s %-16s status %d, %u queries%s\n", check->address,
+	       (check->answered_host != NULL) ? check->answered_host : "-", check->answered_status,
+	       check->received, failed ? "   FAILED" : "");
+	return failed;
+}
+
+int main (int argc, char **argv)
+{
+	ResolverOptions options;
+	struct sockaddr_in address;
+	socklen_t address_len = sizeof(address);
+	char *nameservers[2];
+	Resolver *resolver;
+	GThread *stub_thread;
+	unsigned int i;
+	int fd, waited, failed = 0;
+
+	g_thread_init(NULL);
+	cases_lock = g_mutex_new();
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (fd < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+	    getsockname(fd, (struct sockaddr*)&address, &address_len) != 0)
+	{
+		fprintf(stderr, "can't open the stub nameserver socket: %s\n", g_strerror(errno));
+		return 1;
+	}
+	stub_thread = g_thread_create(&stub_thread_func, GINT_TO_POINTER(fd), TRUE, NULL);
+
+	nameservers[0] = g_strdup_printf("127.0.0.1#%d", ntohs(address.sin_port));
+	nameservers[1] = NULL;
+	memset(&options, 0, sizeof(options));
+	options.nameservers = nameservers;
+	options.timeout_ms = STUB_TIMEOUT_MS;
+	options.attempts = STUB_ATTEMPTS;
+	resolver = resolver_new(&options, &resolved, NULL);
+	for (i=0; i<G_N_ELEMENTS(cases); i++)
+		resolver_request(resolver, cases[i].address, RESOLVER_PRIORITY_NORMAL);
+
+	for (waited=0; waited<CHECK_WAIT_MS && !all_answered(); waited+=10)
+		g_usleep(10 * 1000);
+	g_usleep(STUB_TIMEOUT_MS * 1000); /*for the answers or tries not expected*/
+	resolver_free(resolver);
+	stub_stop = TRUE;
+	g_thread_join(stub_thread);
+	close(fd);
+
+	for (i=0; i<G_N_ELEMENTS(cases); i++)
+	{
+		failed |= check_case(&cases[i]);
+		g_free(cases[i].answered_host);
+	}
+	g_free(nameservers[0]);
+	g_mutex_free(cases_lock);
+	return failed ? 1 : 0;
+}
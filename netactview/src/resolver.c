@@ -0,0 +1,942 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#include "nactv-debug.h"
+#include "resolver.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <glib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+
+#define RESOLV_CONF_PATH "/etc/resolv.conf"
+#define HOSTS_PATH "/etc/hosts"
+#define RESOLVER_FILE_MAX_SIZE (16*1024*1024)
+
+#define MAX_RESOLV_CONF_NAMESERVERS 3 /*as the libc resolver*/
+#define DEFAULT_CONCURRENCY 64
+#define MAX_CONCURRENCY 256 /*each query in flight holds a socket*/
+#define DEFAULT_TIMEOUT_MS 5000
+#define MAX_TIMEOUT_MS 30000
+#define DEFAULT_ATTEMPTS 2
+#define MAX_ATTEMPTS 5
+
+#define DNS_PORT 53
+#define DNS_HEADER_SIZE 12
+#define DNS_QUERY_MAX_SIZE 128 /*the longest PTR query is for IPv6: 90 bytes*/
+#define DNS_PACKET_MAX_SIZE 4096
+#define DNS_NAME_MAX_LEN 255
+#define DNS_MAX_NAME_JUMPS 32
+#define DNS_TYPE_PTR 12
+#define DNS_CLASS_IN 1
+#define DNS_FLAG_RESPONSE 0x80 /*in the third header byte*/
+#define DNS_FLAG_TRUNCATED 0x02
+#define DNS_FLAG_RECURSION_DESIRED 0x01
+#define DNS_RCODE_NO_ERROR 0
+#define DNS_RCODE_NAME_ERROR 3
+
+typedef struct
+{
+	struct sockaddr_storage address;
+	socklen_t address_len;
+} ResolverServer;
+
+typedef struct
+{
+	GList link; /*in the queue of its priority, data is the request*/
+	char *address;
+	int priority;
+} ResolverRequest;
+
+typedef struct
+{
+	char *address; /*as requested*/
+	guint8 query[DNS_QUERY_MAX_SIZE];
+	int query_len;
+	unsigned int server; /*of the last try*/
+	int fd; /*of the last try, on its own source port; -1 if none*/
+	unsigned int tries;
+	double deadline; /*of the last try, on the resolver timer*/
+} ResolverQuery;
+
+struct _Resolver
+{
+	ResolverCallback callback;
+	gpointer user_data;
+	unsigned int concurrency, attempts;
+	int timeout_ms;
+	GArray *servers; /*ResolverServer*/
+	GHashTable *hosts; /*the /etc/hosts names by normalized address text*/
+	int wake_pipe[2];
+	
+	GMutex *lock;
+	GQueue requests[RESOLVER_PRIORITIES_NUMBER]; /*the requests not sent yet*/
+	GHashTable *queued_requests; /*ResolverRequest by address*/
+	volatile gboolean stop_requested;
+	GThread *thread;
+	
+	/* used only by the resolver thread */
+	GHashTable *queries; /*ResolverQuery by DNS id*/
+	GTimer *timer;
+};
+
+
+/* Parses a numeric address into addr (16 bytes), turning the IPv4 mapped IPv6 addresses 
+ * into IPv4 ones. Returns the family or 0 if text is not an address. */
+static int resolver_parse_address (const char *text, guint8 *addr)
+{
+	if (strchr(text, ':') == NULL)
+		return (inet_pton(AF_INET, text, addr) == 1) ? AF_INET : 0;
+	if (inet_pton(AF_INET6, text, addr) != 1)
+		return 0;
+	if (IN6_IS_ADDR_V4MAPPED((struct in6_addr*)addr))
+	{
+		memmove(addr, addr + 12, 4);
+		return AF_INET;
+	}
+	return AF_INET6;
+}
+
+static gboolean address_is_zero (int family, const guint8 *addr)
+{
+	int i, len = (family == AF_INET6) ? 16 : 4;
+	for (i=0; i<len; i++)
+	{
+		if (addr[i] != 0)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* The key of an address in the hosts hash */
+static char *resolver_address_key (int family, const guint8 *addr)
+{
+	char text[INET6_ADDRSTRLEN];
+	inet_ntop(family, addr, text, sizeof(text));
+	return g_strdup(text);
+}
+
+
+/* Appends "address[#port]" to the nameservers; the IPv6 addresses may have a %interface scope */
+static gboolean resolver_add_server (Resolver *resolver, const char *text)
+{
+	ResolverServer server;
+	char address[INET6_ADDRSTRLEN + IF_NAMESIZE + 1];
+	const char *port_text = strchr(text, '#');
+	size_t address_len = (port_text != NULL) ? (size_t)(port_text - text) : strlen(text);
+	char *scope;
+	int port = DNS_PORT;
+	
+	if (address_len >= sizeof(address))
+		goto invalid;
+	memcpy(address, text, address_len);
+	address[address_len] = '\0';
+	if (port_text != NULL)
+	{
+		char *end;
+		port = (int)strtol(port_text + 1, &end, 10);
+		if (*end != '\0' || port <= 0 || port > 65535)
+			goto invalid;
+	}
+	scope = strchr(address, '%');
+	if (scope != NULL)
+		*scope++ = '\0';
+	
+	memset(&server, 0, sizeof(server));
+	if (scope == NULL && inet_pton(AF_INET, address, 
+	                               &((struct sockaddr_in*)&server.address)->sin_addr) == 1)
+	{
+		struct sockaddr_in *sin = (struct sockaddr_in*)&server.address;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		server.address_len = sizeof(struct sockaddr_in);
+	}else if (inet_pton(AF_INET6, address, 
+	                    &((struct sockaddr_in6*)&server.address)->sin6_addr) == 1)
+	{
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&server.address;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		if (scope != NULL)
+			sin6->sin6_scope_id = if_nametoindex(scope);
+		server.address_len = sizeof(struct sockaddr_in6);
+	}else
+		goto invalid;
+	
+	g_array_append_val(resolver->servers, server);
+	return TRUE;
+	
+invalid:
+	nactv_trace("invalid nameserver %s\n", text);
+	return FALSE;
+}
+
+static gboolean resolver_is_server (Resolver *resolver, const struct sockaddr_storage *address)
+{
+	unsigned int i;
+	for (i=0; i<resolver->servers->len; i++)
+	{
+		const ResolverServer *server = &g_array_index(resolver->servers, ResolverServer, i);
+		if (server->address.ss_family != address->ss_family)
+			continue;
+		if (address->ss_family == AF_INET)
+		{
+			const struct sockaddr_in *a = (const struct sockaddr_in*)&server->address;
+			const struct sockaddr_in *b = (const struct sockaddr_in*)address;
+			if (a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr)
+				return TRUE;
+		}else
+		{
+			const struct sockaddr_in6 *a = (const struct sockaddr_in6*)&server->address;
+			const struct sockaddr_in6 *b = (const struct sockaddr_in6*)address;
+			if (a->sin6_port == b->sin6_port && 
+			    memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0)
+				return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+
+/* Returns the lines of a configuration file split in words, without the comments; NULL if 
+ * the file can't be read. Free with g_strfreev on each line and g_ptr_array_free. */
+static GPtrArray *read_config_words (const char *path)
+{
+	FileReadBuf read_buf = read_file_ex(path, RESOLVER_FILE_MAX_SIZE, 4096);
+	GPtrArray *result;
+	char **lines;
+	int i;
+	
+	if (!read_buf.isComplete)
+	{
+		nactv_trace("%s can't be read\n", path);
+		file_readbuf_free_data(&read_buf);
+		return NULL;
+	}
+	
+	result = g_ptr_array_new();
+	lines = g_strsplit(read_buf.data, "\n", -1);
+	for (i=0; lines[i] != NULL; i++)
+	{
+		char *comment = strpbrk(lines[i], "#;");
+		char **words;
+		int j, nwords = 0;
+		
+		if (comment != NULL)
+			*comment = '\0';
+		words = g_strsplit_set(lines[i], " \t\r", -1);
+		for (j=0; words[j] != NULL; j++) /*drop the empty words of repeated separators*/
+		{
+			if (words[j][0] != '\0')
+				words[nwords++] = words[j];
+			else
+				g_free(words[j]);
+		}
+		words[nwords] = NULL;
+		if (nwords > 0)
+			g_ptr_array_add(result, words);
+		else
+			g_strfreev(words);
+	}
+	g_strfreev(lines);
+	file_readbuf_free_data(&read_buf);
+	return result;
+}
+
+static void free_config_words (GPtrArray *lines)
+{
+	unsigned int i;
+	for (i=0; i<lines->len; i++)
+		g_strfreev((char**)g_ptr_array_index(lines, i));
+	g_ptr_array_free(lines, TRUE);
+}
+
+static void resolver_read_resolv_conf (Resolver *resolver, gboolean add_servers, 
+                                       int *timeout_ms, int *attempts)
+{
+	GPtrArray *lines = read_config_words(RESOLV_CONF_PATH);
+	int nservers = 0;
+	unsigned int i;
+	
+	if (lines == NULL)
+		return;
+	for (i=0; i<lines->len; i++)
+	{
+		char **words = (char**)g_ptr_array_index(lines, i);
+		int j;
+		
+		if (strcmp(words[0], "nameserver") == 0 && words[1] != NULL)
+		{
+			if (add_servers && nservers < MAX_RESOLV_CONF_NAMESERVERS && 
+			    resolver_add_server(resolver, words[1]))
+				nservers++;
+		}else if (strcmp(words[0], "options") == 0)
+		{
+			for (j=1; words[j] != NULL; j++)
+			{
+				if (strncmp(words[j], "timeout:", strlen("timeout:")) == 0)
+					*timeout_ms = atoi(words[j] + strlen("timeout:")) * 1000;
+				else if (strncmp(words[j], "attempts:", strlen("attempts:")) == 0)
+					*attempts = atoi(words[j] + strlen("attempts:"));
+			}
+		}
+	}
+	free_config_words(lines);
+}
+
+/* The first name of an address is used, like the libc resolver */
+static void resolver_read_hosts (Resolver *resolver)
+{
+	GPtrArray *lines = read_config_words(HOSTS_PATH);
+	unsigned int i;
+	
+	if (lines == NULL)
+		return;
+	for (i=0; i<lines->len; i++)
+	{
+		char **words = (char**)g_ptr_array_index(lines, i);
+		guint8 addr[16];
+		int family = resolver_parse_address(words[0], addr);
+		
+		if (family != 0 && words[1] != NULL)
+		{
+			char *key = resolver_address_key(family, addr);
+			if (g_hash_table_lookup(resolver->hosts, key) == NULL)
+				g_hash_table_insert(resolver->hosts, key, g_strdup(words[1]));
+			else
+				g_free(key);
+		}
+	}
+	free_config_words(lines);
+}
+
+
+static int dns_append_label (guint8 *packet, int len, const char *label)
+{
+	int label_len = strlen(label);
+	packet[len] = (guint8)label_len;
+	memcpy(packet + len + 1, label, label_len);
+	return len + 1 + label_len;
+}
+
+/* Writes the PTR query of an address: d.c.b.a.in-addr.arpa or the reversed nibbles 
+ * of an IPv6 address in ip6.arpa. Returns the query length. */
+static int dns_build_ptr_query (guint8 *query, guint16 id, int family, const guint8 *addr)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	char label[4];
+	int len = DNS_HEADER_SIZE, i;
+	
+	memset(query, 0, DNS_HEADER_SIZE);
+	query[0] = (guint8)(id >> 8);
+	query[1] = (guint8)id;
+	query[2] = DNS_FLAG_RECURSION_DESIRED;
+	query[5] = 1; /*one question*/
+	
+	if (family == AF_INET)
+	{
+		for (i=3; i>=0; i--)
+		{
+			n_snprintf(label, sizeof(label), "%u", (unsigned int)addr[i]);
+			len = dns_append_label(query, len, label);
+		}
+		len = dns_append_label(query, len, "in-addr");
+	}else
+	{
+		label[1] = '\0';
+		for (i=15; i>=0; i--)
+		{
+			label[0] = hex_digits[addr[i] & 0x0f];
+			len = dns_append_label(query, len, label);
+			label[0] = hex_digits[addr[i] >> 4];
+			len = dns_append_label(query, len, label);
+		}
+		len = dns_append_label(query, len, "ip6");
+	}
+	len = dns_append_label(query, len, "arpa");
+	query[len++] = 0;
+	query[len++] = 0;
+	query[len++] = DNS_TYPE_PTR;
+	query[len++] = 0;
+	query[len++] = DNS_CLASS_IN;
+	g_assert(len <= DNS_QUERY_MAX_SIZE);
+	return len;
+}
+
+/* Reads the name at offset, following the compression pointers, into name (can be NULL) 
+ * as dotted text; the unprintable characters are replaced with '?'. 
+ * Returns the offset past the name in its place or -1 if the name is malformed. */
+static int dns_read_name (const guint8 *packet, int len, int offset, char *name, int name_size)
+{
+	int end = -1, name_len = 0, jumps = 0;
+	
+	while (TRUE)
+	{
+		int label_len, i;
+		
+		if (offset >= len)
+			return -1;
+		label_len = packet[offset];
+		if ((label_len & 0xc0) == 0xc0)
+		{
+			if (offset + 1 >= len || ++jumps > DNS_MAX_NAME_JUMPS)
+				return -1;
+			if (end < 0)
+				end = offset + 2;
+			offset = ((label_len & 0x3f) << 8) | packet[offset + 1];
+			continue;
+		}
+		if ((label_len & 0xc0) != 0)
+			return -1;
+		offset++;
+		if (label_len == 0)
+			break;
+		if (offset + label_len > len)
+			return -1;
+		if (name != NULL)
+		{
+			if (name_len + label_len + 2 > name_size)
+				return -1;
+			if (name_len > 0)
+				name[name_len++] = '.';
+			for (i=0; i<label_len; i++)
+			{
+				guint8 c = packet[offset + i];
+				name[name_len++] = (c > ' ' && c < 127 && c != '.') ? (char)c : '?';
+			}
+		}
+		offset += label_len;
+	}
+	if (name != NULL)
+		name[name_len] = '\0';
+	return (end >= 0) ? end : offset;
+}
+
+/* Returns the RESOLVER_... status of an answer to query, with the name in host if found, 
+ * or -1 if packet is not an answer to query */
+static int dns_parse_ptr_answer (const guint8 *packet, int len, const guint8 *query, int query_len, 
+                                 char *host, int host_size)
+{
+	int offset, answers, i;
+	
+	if (len < query_len || packet[0] != query[0] || packet[1] != query[1] || 
+	    (packet[2] & DNS_FLAG_RESPONSE) == 0 || packet[4] != 0 || packet[5] != 1)
+		return -1;
+	for (i=DNS_HEADER_SIZE; i<query_len; i++) /*the question is sent back*/
+	{
+		if (g_ascii_tolower(packet[i]) != g_ascii_tolower(query[i]))
+			return -1;
+	}
+	
+	switch (packet[3] & 0x0f)
+	{
+	case DNS_RCODE_NO_ERROR:
+		break;
+	case DNS_RCODE_NAME_ERROR:
+		return RESOLVER_NOT_FOUND;
+	default:
+		return RESOLVER_FAILED;
+	}
+	
+	answers = (packet[6] << 8) | packet[7];
+	offset = query_len;
+	for (i=0; i<answers; i++)
+	{
+		int type, data_len;
+		
+		offset = dns_read_name(packet, len, offset, NULL, 0);
+		if (offset < 0 || offset + 10 > len)
+			break;
+		type = (packet[offset] << 8) | packet[offset + 1];
+		data_len = (packet[offset + 8] << 8) | packet[offset + 9];
+		offset += 10;
+		if (offset + data_len > len)
+			break;
+		if (type == DNS_TYPE_PTR && dns_read_name(packet, len, offset, host, host_size) >= 0 && 
+		    host[0] != '\0')
+			return RESOLVER_FOUND;
+		offset += data_len;
+	}
+	return (packet[2] & DNS_FLAG_TRUNCATED) ? RESOLVER_FAILED : RESOLVER_NOT_FOUND;
+}
+
+
+static void resolver_query_free (gpointer data)
+{
+	ResolverQuery *query = (ResolverQuery*)data;
+	if (query->fd >= 0)
+		close(query->fd);
+	g_free(query->address);
+	g_free(query);
+}
+
+static guint16 resolver_new_query_id (Resolver *resolver)
+{
+	guint16 id;
+	do
+	{
+		id = (guint16)g_random_int_range(1, 65536);
+	}while (g_hash_table_lookup(resolver->queries, GUINT_TO_POINTER(id)) != NULL);
+	return id;
+}
+
+static void set_fd_flags (int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* Each try is sent from a new socket: the kernel gives it a random ephemeral port, so that 
+ * a spoofed answer has to guess the port as well as the DNS id. The answers to the 
+ * previous tries are dropped with their socket. */
+static void resolver_send_query (Resolver *resolver, ResolverQuery *query)
+{
+	const ResolverServer *server = &g_array_index(resolver->servers, ResolverServer, query->server);
+	ssize_t sent = -1;
+	
+	query->tries++;
+	query->deadline = g_timer_elapsed(resolver->timer, NULL) + resolver->timeout_ms / 1000.0;
+	if (query->fd >= 0)
+		close(query->fd);
+	query->fd = socket(server->address.ss_family, SOCK_DGRAM, 0);
+	if (query->fd >= 0)
+	{
+		set_fd_flags(query->fd);
+		do
+		{
+			sent = sendto(query->fd, query->query, query->query_len, 0, 
+			              (const struct sockaddr*)&server->address, server->address_len);
+		}while (sent < 0 && errno == EINTR);
+	}
+	if (sent != query->query_len)
+		nactv_trace("resolver send error %d\n", errno); /*the query times out*/
+}
+
+static void resolver_complete_query (Resolver *resolver, guint16 id, ResolverQuery *query, 
+                                     int status, const char *host)
+{
+	resolver->callback(query->address, host, status, resolver->user_data);
+	g_hash_table_remove(resolver->queries, GUINT_TO_POINTER(id));
+}
+
+/* Sends the query to the next nameserver, or completes it with status after the last try */
+static void resolver_retry_query (Resolver *resolver, guint16 id, ResolverQuery *query, int status)
+{
+	if (query->tries < resolver->attempts * resolver->servers->len)
+	{
+		query->server = (query->server + 1) % resolver->servers->len;
+		resolver_send_query(resolver, query);
+	}else
+		resolver_complete_query(resolver, id, query, status, NULL);
+}
+
+/* Returns the address of the first queued request by priority or NULL; free with g_free */
+static char *resolver_pop_request (Resolver *resolver)
+{
+	char *address = NULL;
+	int priority;
+	
+	g_mutex_lock(resolver->lock);
+	for (priority=0; priority<RESOLVER_PRIORITIES_NUMBER; priority++)
+	{
+		if (!g_queue_is_empty(&resolver->requests[priority]))
+		{
+			GList *link = g_queue_pop_head_link(&resolver->requests[priority]);
+			ResolverRequest *request = (ResolverRequest*)link->data;
+			g_hash_table_remove(resolver->queued_requests, request->address);
+			address = request->address;
+			g_free(request);
+			break;
+		}
+	}
+	g_mutex_unlock(resolver->lock);
+	return address;
+}
+
+/* Answers the requested addresses without a query when possible and sends the others' 
+ * queries, up to the concurrency */
+static void resolver_start_queries (Resolver *resolver)
+{
+	while (g_hash_table_size(resolver->queries) < resolver->concurrency)
+	{
+		ResolverQuery *query;
+		guint8 addr[16];
+		char *address, *key;
+		const char *host;
+		guint16 id;
+		int family;
+		
+		address = resolver_pop_request(resolver);
+		if (address == NULL)
+			break;
+		
+		family = resolver_parse_address(address, addr);
+		if (family == 0 || address_is_zero(family, addr))
+		{
+			resolver->callback(address, NULL, RESOLVER_NOT_FOUND, resolver->user_data);
+			g_free(address);
+			continue;
+		}
+		key = resolver_address_key(family, addr);
+		host = (const char*)g_hash_table_lookup(resolver->hosts, key);
+		g_free(key);
+		if (host != NULL)
+		{
+			resolver->callback(address, host, RESOLVER_FOUND, resolver->user_data);
+			g_free(address);
+			continue;
+		}
+		
+		query = g_new0(ResolverQuery, 1);
+		query->address = address;
+		query->fd = -1;
+		id = resolver_new_query_id(resolver);
+		query->query_len = dns_build_ptr_query(query->query, id, family, addr);
+		g_hash_table_insert(resolver->queries, GUINT_TO_POINTER(id), query);
+		resolver_send_query(resolver, query);
+	}
+}
+
+typedef struct
+{
+	double now;
+	GArray *ids; /*guint16*/
+} ExpiredQueries;
+
+static void add_expired_query_id (gpointer key, gpointer value, gpointer user_data)
+{
+	const ResolverQuery *query = (const ResolverQuery*)value;
+	ExpiredQueries *expired = (ExpiredQueries*)user_data;
+	
+	if (query->deadline <= expired->now)
+	{
+		guint16 id = (guint16)GPOINTER_TO_UINT(key);
+		g_array_append_val(expired->ids, id);
+	}
+}
+
+static void resolver_retry_expired_queries (Resolver *resolver)
+{
+	ExpiredQueries expired;
+	unsigned int i;
+	
+	expired.now = g_timer_elapsed(resolver->timer, NULL);
+	expired.ids = g_array_new(FALSE, FALSE, sizeof(guint16));
+	g_hash_table_foreach(resolver->queries, &add_expired_query_id, &expired);
+	for (i=0; i<expired.ids->len; i++)
+	{
+		guint16 id = g_array_index(expired.ids, guint16, i);
+		ResolverQuery *query = (ResolverQuery*)g_hash_table_lookup(resolver->queries, 
+		                                                          GUINT_TO_POINTER(id));
+		resolver_retry_query(resolver, id, query, RESOLVER_FAILED);
+	}
+	g_array_free(expired.ids, TRUE);
+}
+
+static void find_first_deadline (gpointer key, gpointer value, gpointer user_data)
+{
+	const ResolverQuery *query = (const ResolverQuery*)value;
+	double *deadline = (double*)user_data;
+	if (*deadline < 0 || query->deadline < *deadline)
+		*deadline = query->deadline;
+}
+
+/* Returns the poll timeout in ms until the first deadline, -1 if no query is in flight */
+static int resolver_poll_timeout (Resolver *resolver)
+{
+	double deadline = -1, wait;
+	
+	g_hash_table_foreach(resolver->queries, &find_first_deadline, &deadline);
+	if (deadline < 0)
+		return -1;
+	wait = deadline - g_timer_elapsed(resolver->timer, NULL);
+	return (wait > 0) ? (int)(wait * 1000) + 1 : 0;
+}
+
+/* Reads the answers waiting on the socket of the query id until one is accepted */
+static void resolver_receive (Resolver *resolver, guint16 id)
+{
+	guint8 packet[DNS_PACKET_MAX_SIZE];
+	char host[DNS_NAME_MAX_LEN + 1];
+	
+	while (TRUE)
+	{
+		struct sockaddr_storage from;
+		socklen_t from_len = sizeof(from);
+		ResolverQuery *query;
+		ssize_t received;
+		int status;
+		
+		query = (ResolverQuery*)g_hash_table_lookup(resolver->queries, GUINT_TO_POINTER(id));
+		if (query == NULL || query->fd < 0)
+			break;
+		received = recvfrom(query->fd, packet, sizeof(packet), 0, 
+		                    (struct sockaddr*)&from, &from_len);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received < 0)
+			break; /*no more answers waiting*/
+		if (received < DNS_HEADER_SIZE || !resolver_is_server(resolver, &from) || 
+		    ((packet[0] << 8) | packet[1]) != id)
+			continue;
+		
+		status = dns_parse_ptr_answer(packet, (int)received, query->query, query->query_len, 
+		                              host, sizeof(host));
+		if (status == RESOLVER_FAILED)
+			resolver_retry_query(resolver, id, query, status);
+		else if (status >= 0)
+			resolver_complete_query(resolver, id, query, status, 
+			                        (status == RESOLVER_FOUND) ? host : NULL);
+		if (status >= 0)
+			break; /*the socket is closed*/
+	}
+}
+
+typedef struct
+{
+	struct pollfd *fds;
+	guint16 *ids; /*of the query polled by the fds of the same index*/
+	int nfds;
+} ResolverPollSet;
+
+static void add_query_poll_fd (gpointer key, gpointer value, gpointer user_data)
+{
+	const ResolverQuery *query = (const ResolverQuery*)value;
+	ResolverPollSet *set = (ResolverPollSet*)user_data;
+	
+	if (query->fd < 0)
+		return;
+	set->fds[set->nfds].fd = query->fd;
+	set->fds[set->nfds].events = POLLIN;
+	set->fds[set->nfds].revents = 0;
+	set->ids[set->nfds] = (guint16)GPOINTER_TO_UINT(key);
+	set->nfds++;
+}
+
+static gpointer resolver_thread_func (gpointer data)
+{
+	Resolver *resolver = (Resolver*)data;
+	
+	ResolverPollSet set;
+	
+	/* the wake pipe and a socket per query in flight */
+	set.fds = g_new(struct pollfd, resolver->concurrency + 1);
+	set.ids = g_new(guint16, resolver->concurrency + 1);
+	while (!resolver->stop_requested)
+	{
+		int i;
+		
+		resolver_retry_expired_queries(resolver);
+		resolver_start_queries(resolver);
+		
+		set.nfds = 0;
+		set.fds[set.nfds].fd = resolver->wake_pipe[0];
+		set.fds[set.nfds].events = POLLIN;
+		set.fds[set.nfds].revents = 0;
+		set.ids[set.nfds++] = 0;
+		g_hash_table_foreach(resolver->queries, &add_query_poll_fd, &set);
+		if (poll(set.fds, set.nfds, resolver_poll_timeout(resolver)) < 0)
+		{
+			if (errno != EINTR)
+				nactv_trace("resolver poll error %d\n", errno);
+			continue;
+		}
+		
+		if (set.fds[0].revents & POLLIN)
+		{
+			char buffer[64];
+			while (read(resolver->wake_pipe[0], buffer, sizeof(buffer)) > 0)
+				;
+		}
+		for (i=1; i<set.nfds; i++)
+		{
+			if (set.fds[i].revents & POLLIN)
+				resolver_receive(resolver, set.ids[i]);
+		}
+	}
+	g_free(set.fds);
+	g_free(set.ids);
+	return NULL;
+}
+
+static void resolver_wake (Resolver *resolver)
+{
+	char c = 0;
+	/* a full pipe is awake already */
+	if (write(resolver->wake_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+		nactv_trace("resolver wake error %d\n", errno);
+}
+
+
+Resolver *resolver_new (const ResolverOptions *options, ResolverCallback callback, 
+                        gpointer user_data)
+{
+	Resolver *resolver = g_new0(Resolver, 1);
+	int timeout_ms = DEFAULT_TIMEOUT_MS, attempts = DEFAULT_ATTEMPTS;
+	gboolean configured_servers = (options != NULL && options->nameservers != NULL);
+	unsigned int i;
+	
+	resolver->callback = callback;
+	resolver->user_data = user_data;
+	
+	resolver->servers = g_array_new(FALSE, TRUE, sizeof(ResolverServer));
+	if (configured_servers)
+	{
+		for (i=0; options->nameservers[i] != NULL; i++)
+			resolver_add_server(resolver, options->nameservers[i]);
+	}
+	resolver_read_resolv_conf(resolver, !configured_servers, &timeout_ms, &attempts);
+	if (resolver->servers->len == 0)
+		resolver_add_server(resolver, "127.0.0.1"); /*the libc resolver default*/
+	
+	if (options != NULL && options->timeout_ms > 0)
+		timeout_ms = options->timeout_ms;
+	if (options != NULL && options->attempts > 0)
+		attempts = options->attempts;
+	resolver->timeout_ms = CLAMP(timeout_ms, 1, MAX_TIMEOUT_MS);
+	resolver->attempts = CLAMP(attempts, 1, MAX_ATTEMPTS);
+	resolver->concurrency = (options != NULL && options->concurrency > 0) ? 
+		MIN(options->concurrency, MAX_CONCURRENCY) : DEFAULT_CONCURRENCY;
+	
+	resolver->hosts = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &g_free);
+	resolver_read_hosts(resolver);
+	
+	ERROR_IF(pipe(resolver->wake_pipe) != 0);
+	set_fd_flags(resolver->wake_pipe[0]);
+	set_fd_flags(resolver->wake_pipe[1]);
+	
+	resolver->lock = g_mutex_new();
+	for (i=0; i<RESOLVER_PRIORITIES_NUMBER; i++)
+		g_queue_init(&resolver->requests[i]);
+	resolver->queued_requests = g_hash_table_new(&g_str_hash, &g_str_equal);
+	resolver->queries = g_hash_table_new_full(&g_direct_hash, &g_direct_equal, NULL, 
+	                                          &resolver_query_free);
+	resolver->timer = g_timer_new();
+	
+	resolver->thread = g_thread_create(&resolver_thread_func, resolver, TRUE, NULL);
+	g_assert(resolver->thread != NULL);
+	return resolver;
+}
+
+void resolver_free (Resolver *resolver)
+{
+	char *address;
+	int i;
+	
+	if (resolver == NULL)
+		return;
+	resolver->stop_requested = TRUE;
+	resolver_wake(resolver);
+	g_thread_join(resolver->thread);
+	
+	g_hash_table_destroy(resolver->queries);
+	g_timer_destroy(resolver->timer);
+	while ((address = resolver_pop_request(resolver)) != NULL)
+		g_free(address);
+	g_hash_table_destroy(resolver->queued_requests);
+	g_mutex_free(resolver->lock);
+	
+	for (i=0; i<2; i++)
+		close(resolver->wake_pipe[i]);
+	g_hash_table_destroy(resolver->hosts);
+	g_array_free(resolver->servers, TRUE);
+	g_free(resolver);
+}
+
+static gboolean resolver_has_requests (Resolver *resolver)
+{
+	int priority;
+	for (priority=0; priority<RESOLVER_PRIORITIES_NUMBER; priority++)
+	{
+		if (!g_queue_is_empty(&resolver->requests[priority]))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void resolver_move_request (Resolver *resolver, ResolverRequest *request, int priority)
+{
+	g_queue_unlink(&resolver->requests[request->priority], &request->link);
+	g_queue_push_tail_link(&resolver->requests[priority], &request->link);
+	request->priority = priority;
+}
+
+void resolver_request (Resolver *resolver, const char *address, int priority)
+{
+	ResolverRequest *request;
+	gboolean was_empty;
+	
+	g_assert(priority>=0 && priority<RESOLVER_PRIORITIES_NUMBER);
+	g_mutex_lock(resolver->lock);
+	was_empty = !resolver_has_requests(resolver);
+	request = (ResolverRequest*)g_hash_table_lookup(resolver->queued_requests, address);
+	if (request == NULL)
+	{
+		request = g_new0(ResolverRequest, 1);
+		request->link.data = request;
+		request->address = g_strdup(address);
+		request->priority = priority;
+		g_queue_push_tail_link(&resolver->requests[priority], &request->link);
+		g_hash_table_insert(resolver->queued_requests, request->address, request);
+	}else if (priority < request->priority)
+		resolver_move_request(resolver, request, priority);
+	g_mutex_unlock(resolver->lock);
+	
+	if (was_empty)
+		resolver_wake(resolver);
+}
+
+static void resolver_move_requests (Resolver *resolver, const GPtrArray *addresses, int priority)
+{
+	unsigned int i;
+	for (i=0; i<addresses->len; i++)
+	{
+		ResolverRequest *request = (ResolverRequest*)g_hash_table_lookup(resolver->queued_requests, 
+		                                     g_ptr_array_index(addresses, i));
+		if (request != NULL && request->priority != priority)
+			resolver_move_request(resolver, request, priority);
+	}
+}
+
+void resolver_set_priorities (Resolver *resolver, const GPtrArray *high, const GPtrArray *normal)
+{
+	GQueue *low = &resolver->requests[RESOLVER_PRIORITY_LOW];
+	int priority;
+	
+	g_mutex_lock(resolver->lock);
+	/* the previous high and normal requests go first in the low queue, in their order */
+	for (priority=RESOLVER_PRIORITY_NORMAL; priority>=RESOLVER_PRIORITY_HIGH; priority--)
+	{
+		while (!g_queue_is_empty(&resolver->requests[priority]))
+		{
+			GList *link = g_queue_pop_tail_link(&resolver->requests[priority]);
+			((ResolverRequest*)link->data)->priority = RESOLVER_PRIORITY_LOW;
+			g_queue_push_head_link(low, link);
+		}
+	}
+	resolver_move_requests(resolver, normal, RESOLVER_PRIORITY_NORMAL);
+	resolver_move_requests(resolver, high, RESOLVER_PRIORITY_HIGH);
+	g_mutex_unlock(resolver->lock);
+}
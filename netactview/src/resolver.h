@@ -0,0 +1,73 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 4; tab-width: 4 -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#ifndef NACTV_RESOLVER_H
+#define NACTV_RESOLVER_H
+
+#include <glib.h>
+
+/* An event driven reverse DNS resolver: one thread sends the PTR queries of many addresses, 
+ * each try from its own UDP socket on a random source port, and matches the answers as they 
+ * arrive. The addresses found in /etc/hosts are answered without a query. */
+typedef struct _Resolver Resolver;
+
+enum
+{
+	RESOLVER_FOUND,
+	RESOLVER_NOT_FOUND, /*the nameserver answered that the address has no name*/
+	RESOLVER_FAILED /*no nameserver answered in time*/
+};
+
+/* The queued requests are sent by priority, then in the order of the requests */
+enum
+{
+	RESOLVER_PRIORITY_HIGH,
+	RESOLVER_PRIORITY_NORMAL,
+	RESOLVER_PRIORITY_LOW,
+	RESOLVER_PRIORITIES_NUMBER
+};
+
+typedef struct
+{
+	/* "address" or "address#port" texts; NULL for the nameservers of /etc/resolv.conf */
+	char **nameservers;
+	int concurrency; /*the maximum number of queries in flight, each with a socket; 0 for the default*/
+	int timeout_ms; /*waited for an answer before the next try; 0 for resolv.conf timeout*/
+	int attempts; /*tries through all the nameservers; 0 for resolv.conf attempts*/
+} ResolverOptions;
+
+/* Called on the resolver thread for each request; host is NULL unless status is RESOLVER_FOUND */
+typedef void (*ResolverCallback) (const char *address, const char *host, int status, 
+                                  gpointer user_data);
+
+/* options can be NULL for the defaults */
+Resolver *resolver_new (const ResolverOptions *options, ResolverCallback callback, 
+                        gpointer user_data);
+/* Stops the resolver thread; the requests not answered yet get no callback */
+void resolver_free (Resolver *resolver);
+
+/* Queues the name request of a numeric IPv4 or IPv6 address; can be called from any thread. 
+ * An address requested again while queued is queued once, at the higher priority; 
+ * the one requested again while its query is in flight gets a callback per request. */
+void resolver_request (Resolver *resolver, const char *address, int priority);
+/* Moves the queued requests of the high addresses to the high priority, of the normal ones 
+ * to the normal priority and all the others to the low priority. The arrays hold the 
+ * address texts. */
+void resolver_set_priorities (Resolver *resolver, const GPtrArray *high, const GPtrArray *normal);
+
+
+#endif /*NACTV_RESOLVER_H*/
@@ -377,6 +377,34 @@ const char *get_file_extension (const char *fileName)
 	return extension;
 }
 
+gboolean string_is_ascii (const char *str, size_t len)
+{
+	/* eight bytes at a time: no high bit set in any of them */
+	const guint64 highBits = 0x8080808080808080ULL;
+	guint64 word, any = 0;
+	size_t i = 0;
+	for (; i + sizeof(word) <= len; i += sizeof(word))
+	{
+		memcpy(&word, str + i, sizeof(word));
+		any |= word;
+	}
+	if ((any & highBits) != 0)
+		return FALSE;
+	for (; i < len; i++)
+		if ((guchar)str[i] >= 0x80)
+			return FALSE;
+	return TRUE;
+}
+
+
+double get_process_cpu_time ()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.;
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + 
+	       (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
 
 /* Read file and store up to maxDataLen bytes in FileReadBuf::data, plus a terminating null byte
  *  - data is NULL if the file can't be opened 
@@ -422,3 +450,80 @@ void file_readbuf_free_data(FileReadBuf *readBuf)
 }
 
 
+struct _BoundedQueue
+{
+	GQueue *items;
+	unsigned int capacity;
+	gboolean closed;
+	GMutex *lock;
+	GCond *not_empty, *not_full;
+};
+
+BoundedQueue *bounded_queue_new (unsigned int capacity)
+{
+	BoundedQueue *queue = (BoundedQueue*)g_malloc0(sizeof(BoundedQueue));
+	g_assert(capacity > 0);
+	queue->items = g_queue_new();
+	queue->capacity = capacity;
+	queue->lock = g_mutex_new();
+	queue->not_empty = g_cond_new();
+	queue->not_full = g_cond_new();
+	return queue;
+}
+
+gboolean bounded_queue_push (BoundedQueue *queue, gpointer item)
+{
+	gboolean pushed;
+	g_assert(item != NULL);
+	
+	g_mutex_lock(queue->lock);
+	while (!queue->closed && queue->items->length >= queue->capacity)
+		g_cond_wait(queue->not_full, queue->lock);
+	pushed = !queue->closed;
+	if (pushed)
+	{
+		g_queue_push_tail(queue->items, item);
+		g_cond_signal(queue->not_empty);
+	}
+	g_mutex_unlock(queue->lock);
+	return pushed;
+}
+
+gpointer bounded_queue_pop (BoundedQueue *queue)
+{
+	gpointer item;
+	
+	g_mutex_lock(queue->lock);
+	while (!queue->closed && g_queue_is_empty(queue->items))
+		g_cond_wait(queue->not_empty, queue->lock);
+	item = g_queue_pop_head(queue->items);
+	if (item != NULL)
+		g_cond_signal(queue->not_full);
+	g_mutex_unlock(queue->lock);
+	return item;
+}
+
+void bounded_queue_close (BoundedQueue *queue)
+{
+	g_mutex_lock(queue->lock);
+	queue->closed = TRUE;
+	g_cond_broadcast(queue->not_empty);
+	g_cond_broadcast(queue->not_full);
+	g_mutex_unlock(queue->lock);
+}
+
+void bounded_queue_free (BoundedQueue *queue, GDestroyNotify free_item)
+{
+	if (queue != NULL)
+	{
+		gpointer item;
+		while ((item = g_queue_pop_head(queue->items)) != NULL)
+			if (free_item != NULL)
+				free_item(item);
+		g_queue_free(queue->items);
+		g_mutex_free(queue->lock);
+		g_cond_free(queue->not_empty);
+		g_cond_free(queue->not_full);
+		g_free(queue);
+	}
+}
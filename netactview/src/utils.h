@@ -59,6 +59,12 @@ char *string_replace (const char* str, const char * from, const char* to);
 
 const char *get_file_extension (const char *fileName);
 
+/* TRUE if the first len bytes of str are all ASCII */
+gboolean string_is_ascii (const char *str, size_t len);
+
+/* The user and system CPU time used by all the threads of the process, in seconds */
+double get_process_cpu_time ();
+
 
 struct _DropToSudoData;
 typedef struct _DropToSudoData DropToSudoData;
@@ -87,6 +93,19 @@ FileReadBuf read_file_ex(const char *path, size_t maxDataLen, size_t initialBufS
 void file_readbuf_free_data(FileReadBuf *readBuf);
 
 
+/* A FIFO of at most capacity items between threads. push waits while the queue is full and 
+ * pop while it is empty. After close, push returns FALSE and pop returns NULL once empty. */
+typedef struct _BoundedQueue BoundedQueue;
+
+BoundedQueue *bounded_queue_new (unsigned int capacity);
+/* item may not be NULL */
+gboolean bounded_queue_push (BoundedQueue *queue, gpointer item);
+gpointer bounded_queue_pop (BoundedQueue *queue);
+void bounded_queue_close (BoundedQueue *queue);
+/* free_item is called for the items left, if not NULL */
+void bounded_queue_free (BoundedQueue *queue, GDestroyNotify free_item);
+
+
 /************** Inline implementations: */
 
 /* snprintf function that does not allow string truncation */
@@ -102,6 +121,22 @@ static inline int n_snprintf (char *str, size_t size, const char *format, ...)
 	return print_len;
 }
 
+/* 64 bit FNV-1a hash; start with FNV64_OFFSET_BASIS and chain the calls to hash more buffers */
+#define FNV64_OFFSET_BASIS 14695981039346656037ULL
+#define FNV64_PRIME 1099511628211ULL
+
+static inline guint64 hash_fnv1a_64 (guint64 hash, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	size_t i;
+	for (i=0; i<len; i++)
+	{
+		hash ^= p[i];
+		hash *= FNV64_PRIME;
+	}
+	return hash;
+}
+
 /* strlcpy function that does not allow string truncation */
 static inline size_t n_strlcpy (char *dest, const char *src, size_t dest_size)
 {